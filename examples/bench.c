@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200112L // for `clock_gettime`
+#include "ltre.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// compares serial and parallel compilation of a pattern, for a doubling number
+// of threads. times are wall-clock, so they scale with the number of cores.
+// given a file, compares serial and speculative parallel matching of the file
+// as a single line instead. processor times are shown too: their excess over
+// the serial run is the work wasted on speculation
+
+double now(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bench(struct regex *regex, int threads) {
+  double start = now(CLOCK_MONOTONIC);
+  struct dstate *dfa = threads ? ltre_determinize_parallel(regex, threads)
+                               : ltre_determinize(regex);
+  double mid = now(CLOCK_MONOTONIC);
+  int dfa_size = dfa_get_size(dfa);
+  threads ? dfa_minimize_parallel(dfa, threads) : dfa_minimize(dfa);
+  double end = now(CLOCK_MONOTONIC);
+
+  char label[16] = "serial";
+  if (threads)
+    sprintf(label, "%d thr.", threads);
+  printf("%-8s %8d -> %-8d states  determinize %7.3fs  minimize %7.3fs\n",
+         label, dfa_size, dfa_get_size(dfa), mid - start, end - mid);
+  dfa_free(dfa);
+}
+
+void bench_run(struct dtable *dtable, uint8_t *data, size_t size,
+               int threads) {
+  // best of a few runs, as a single run takes a fraction of a second
+  double wall = 1e9, cpu = 1e9;
+  uint32_t id;
+  for (int i = 0; i < 5; i++) {
+    double start = now(CLOCK_MONOTONIC);
+    double start_cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+    id = dtable->initial;
+    if (threads)
+      id = dtable_run_parallel(dtable, id, data, data + size, threads);
+    else
+      dtable_run(dtable, &id, data, data + size, EOF);
+    double end = now(CLOCK_MONOTONIC);
+    double end_cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+    wall = end - start < wall ? end - start : wall;
+    cpu = end_cpu - start_cpu < cpu ? end_cpu - start_cpu : cpu;
+  }
+
+  char label[16] = "serial";
+  if (threads)
+    sprintf(label, "%d thr.", threads);
+  printf("%-8s %8.1f MB/s  wall %7.3fs  processor %7.3fs  %s\n", label,
+         size / wall / 1e6, wall, cpu,
+         dtable_accepting(dtable, id) ? "match" : "no match");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4)
+    fprintf(stderr, "Usage: bench <pattern> [max_threads] [file]\n"),
+        exit(EXIT_FAILURE);
+  char *pattern = argv[1];
+  int max_threads = argc >= 3 ? atoi(argv[2]) : 8;
+
+  char *error = NULL, *loc = pattern;
+  struct regex *regex = ltre_parse(&loc, &error);
+  if (error)
+    fprintf(stderr, "parse error: %s at pattern[%zu] near '%.16s'\n", error,
+            loc - pattern, loc),
+        exit(EXIT_FAILURE);
+
+  if (argc == 4) {
+    FILE *fp = fopen(argv[3], "rb");
+    if (fp == NULL)
+      perror(argv[3]), exit(EXIT_FAILURE);
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    uint8_t *data = malloc(size + 1);
+    rewind(fp), size = fread(data, 1, size, fp), fclose(fp);
+
+    struct dstate *dfa = ltre_compile(regex);
+    struct dtable *dtable = dtable_alloc(dfa);
+    printf("%d states, %zu bytes\n", dfa_get_size(dfa), size);
+    bench_run(dtable, data, size, 0);
+    for (int threads = 2; threads <= max_threads; threads *= 2)
+      bench_run(dtable, data, size, threads);
+    dtable_free(dtable), dfa_free(dfa), free(data);
+    return 0;
+  }
+
+  bench(regex_incref(regex), 0);
+  for (int threads = 1; threads <= max_threads; threads *= 2)
+    bench(regex_incref(regex), threads);
+  regex_decref(regex);
+}
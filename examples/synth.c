@@ -3,35 +3,47 @@
 #include <stdlib.h>
 
 // steal implementation details. this probably has undefined behavior
+struct dclasses {
+  int len;
+  uint8_t map[256];
+};
 struct dstate {
-  struct dstate *transitions[256];
   bool accepting, terminating;
+  uint8_t nexits, exits[4];
+  int id;
+  struct dstate *next;
+  struct regex *regex;
+  struct dindex *index;
+  struct dclasses *classes;
+  struct dstate *transitions[];
 };
 
+#define TRANSITION(dfa, chr) (dfa)->transitions[(dfa)->classes->map[chr]]
+
 bool run(struct dstate *dfa) {
   // if all outbound transitions are terminating, return. otherwise, if exactly
   // one outbound transition is non-terminating, follow it. otherwise, more than
   // one outbound transition is non-terminating, so let the user disambiguate.
   // interactive use works best with `stty -icanon -echo -nl`
-  for (int chr = 0;; dfa = dfa->transitions[chr]) {
+  for (int chr = 0;; dfa = TRANSITION(dfa, chr)) {
     if (putchar(chr) == EOF)
       break;
 
     for (chr = 0; chr < 256; chr++)
-      if (!dfa->transitions[chr]->terminating)
+      if (!TRANSITION(dfa, chr)->terminating)
         goto found;
     break;
 
   found:
     for (int c = chr + 1; c < 256; c++)
-      if (!dfa->transitions[c]->terminating)
+      if (!TRANSITION(dfa, c)->terminating)
         goto ambiguous;
     continue;
 
   ambiguous:
     if ((chr = getchar()) == EOF)
       break;
-    // if (dfa->transitions[chr]->terminating)
+    // if (TRANSITION(dfa, chr)->terminating)
     //   goto ambiguous;
   }
 
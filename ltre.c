@@ -1,23 +1,47 @@
+#define _POSIX_C_SOURCE 200112L // for `clock_gettime`
 #include "ltre.h"
 #include <ctype.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef __unix__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+// for code paths picked at runtime, based on what the CPU supports
+#define X86_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define METACHARS "\\-.~[]<>%{}*+?:|&=!( )"
 #define SIMPLE_ESCAPES "bfnrtve"
 #define SIMPLE_CODEPTS "\b\f\n\r\t\v\x1b"
 
+#if __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread // GNU extension; C99 has no thread-local storage
+#endif
+
 bool symset_read(symset_t symset, unsigned chr);
 void symset_write(symset_t symset, unsigned chr, bool val);
+uint32_t dtable_step(struct dtable *dtable, uint32_t id, uint8_t chr);
+bool dtable_terminating(struct dtable *dtable, uint32_t id);
+bool dtable_accepting(struct dtable *dtable, uint32_t id);
 
 char *symset_fmt(symset_t symset) {
-  // returns a static buffer. output shall be parsable by `parse_symset` and
-  // satisfy the invariant `parse_symset . symset_fmt == id`. in the general
-  // case, will not satisfy `symset_fmt . parse_symset == id`
+  // returns a thread-local static buffer. output shall be parsable by
+  // `parse_symset` and satisfy the invariant `parse_symset . symset_fmt == id`.
+  // in the general case, will not satisfy `symset_fmt . parse_symset == id`
 
-  static char buf[1024], nbuf[1024];
+  static THREAD_LOCAL char buf[1024], nbuf[1024];
   char *bufp = buf, *nbufp = nbuf;
   // number of characters in `buf` and `nbuf` symset unions, respectively
   int nsym = 0, nnsym = 0;
@@ -73,6 +97,18 @@ char *symset_fmt(symset_t symset) {
   return (bufp - buf < nbufp - nbuf) ? buf : nbuf;
 }
 
+// partition of the input characters into classes such that no symset of some
+// regular expression ever distinguishes two characters of the same class. all
+// derivatives of a regular expression only contain symsets from the regular
+// expression itself, so characters of the same class always yield the same
+// derivative and DFA transitions can be indexed by class instead of by input
+// character. shared by all states of a DFA and owned by its initial state.
+// classes are numbered in order of their smallest input character
+struct dclasses {
+  int len;          // number of classes
+  uint8_t map[256]; // class of every input character
+};
+
 // `struct regex` is a persistent data structure with structural sharing.
 // all regexes are immutable and `refcount`ed. unless otherwise specified,
 // functions that take in regular expressions take ownership of them and
@@ -87,14 +123,21 @@ struct regex {
     TYPE_REPEAT, // r* r+ r? r{m,n}
     TYPE_SYMSET, // a a-b [uv] <uv> ~u
   } type;
-  bool sym_incl; // see `symset` field below
   // a regular expression is nullable if and only if it accepts the empty word.
   // this field is initialized in the smart constructors
   bool nullable;
   // `struct regex` is a persistent data structure with structural sharing, so
   // we want a reference count and a "visited" flag for traversal
   bool visited;
+  // whether the regex was allocated from `arena` rather than with `malloc`
+  bool pooled;
   unsigned refcount;
+  // structural hash, computed once upon construction from the fields below and
+  // from the hashes of the children. see `regex_hash`
+  unsigned hash;
+  // unique identifier, never reused. lets us hold weak references to regexes;
+  // see `regex_lookup`
+  size_t uid;
   // a measure of the size of the regular expression if structural sharing were
   // expanded out, defined as `size(regex) = 1 + sum(size(regex->children))`.
   // this measure is irrelevant the vast majority of the time because structural
@@ -104,22 +147,17 @@ struct regex {
   // there is no upper bound, as in, `upper` is unbounded. for `TYPE_SYMSET`, if
   // `upper == true` then the symset is the universal symset
   unsigned lower, upper;
-  // set of symbols for `TYPE_SYMSET`. also used for caching the most recent
-  // derivative and a conservative set of characters for which it holds: if
-  // `symset_read(regex->symset, chr) == regex->sym_incl` then `regex->delta`
-  // is the derivative of `regex` with respect to `chr`. if `delta` is `NULL`,
-  // no derivative is cached. we need `sym_incl` because otherwise there'd be
-  // no representation for a `TYPE_SYMSET` with a cached derivative that holds
-  // for all characters not in the symset
+  // set of symbols for `TYPE_SYMSET`
   symset_t symset;
-  struct regex *delta;
+  // derivative classes, computed and memoized on demand by `regex_dclasses`.
+  // owned by the regex
+  struct dclasses *dclasses;
   // `NULL`-terminated list of children for `TYPE_ALT` and `TYPE_CONCAT` (which
   // we're free to do because alternation and concatenation are associative), or
   // a single child followed by `NULL` for `TYPE_COMPL` and `TYPE_REPEAT`. must
-  // be acyclic because `regex_decref` won't free cycles. when adding a child we
-  // don't get optimal structural sharing, but using a linked list or a binary
-  // tree would be no different because the smart constructors need to sort the
-  // children anyway.
+  // be acyclic because `regex_decref` won't free cycles. all regexes are hash-
+  // consed by `regex_alloc`, so structurally equal children are always the
+  // same pointer and structural sharing is maximal
   struct regex *children[];
 };
 
@@ -132,13 +170,249 @@ static size_t regexes_len(struct regex *regexes[]) {
   return regex - regexes;
 }
 
+// hash-consing table. every regex is interned upon construction so that
+// structurally equal regexes are always the same pointer, which makes equality
+// checks in `regex_cmp` a pointer comparison. the table doesn't own its
+// entries; `regex_decref` evicts a regex right before freeing it. open
+// addressing with linear probing, kept at most half full
+struct interned {
+  struct regex **slots;
+  size_t len, cap; // `cap` is zero or a power of two
+  size_t uid;      // most recently assigned unique identifier
+};
+
+// memo of derivatives, keyed on a regex and one of its derivative classes; see
+// `regex_dclasses`. keys and values are weak references through unique
+// identifiers, because derivatives often contain the regex they were derived
+// from, and a strong reference would form a cycle that `regex_decref` can't
+// free. direct-mapped so it stays bounded: a colliding entry just replaces the
+// previous one. grows along with the hash-consing table, up to a fixed cap,
+// and is simply cleared when it grows
+#define DELTAS_MAX_CAP (1 << 18)
+struct deltas {
+  struct delta {
+    size_t uid, delta_uid; // zero `uid` means empty slot
+    unsigned delta_hash;
+    uint8_t cls;
+  } *slots;
+  size_t cap;           // zero or a power of two
+  size_t hits, misses;  // see `regex_memo_stats`
+};
+
+// slab allocator for the regexes created during compile sessions, which are
+// mostly short-lived intermediate derivatives. regexes are carved out of large
+// blocks and recycled through one free list per number of children; regexes
+// with many children still use `malloc`. refcounting works as usual, but once
+// every session has ended and every pooled regex has been freed, which is
+// typically right as `ltre_compile` returns, all blocks are released at once
+#define ARENA_CLASSES 8 // pool regexes with fewer children than this
+#define ARENA_BLOCK_SIZE (256 * 1024)
+struct arena {
+  void *blocks;              // linked through their first word
+  char *bump, *end;          // unused part of the most recent block
+  void *free[ARENA_CLASSES]; // linked through their first word
+  size_t live;               // pooled regexes not yet freed
+  int sessions;              // nesting depth of `arena_begin`
+};
+
+// everything regexes share: they are hash-consed and cached together, so they
+// must all come from the same context. regexes and lazily constructed DFAs
+// belong to the context that was current when they were created, and must only
+// be used while it is current. compiled DFAs don't reference any regex, so they
+// aren't tied to any context. a context must not be used by several threads at
+// once, but distinct contexts can be used concurrently without locking; see
+// `ltre_ctx_use`
+struct ltre_ctx {
+  struct interned interned;
+  struct deltas deltas;
+  struct arena arena;
+  size_t bytes; // held by live regexes and the derivative classes they own
+  struct regex *empty, *univ, *eps, *negeps; // see `regex_empty` and friends
+};
+
+// current context of the calling thread. threads that never call
+// `ltre_ctx_use` all share `default_ctx`
+static struct ltre_ctx default_ctx = {0};
+static THREAD_LOCAL struct ltre_ctx *ctx = &default_ctx;
+
+static unsigned regex_hash(struct regex *fields, struct regex *children[]) {
+  // FNV-1a over the fields that determine structural equality followed by
+  // a murmur3 finalizer, because we index the table using the low bits. the
+  // children are interned so they have their hashes computed already
+
+  unsigned hash = 2166136261u;
+#define MIX(N) (hash = (hash ^ (N)) * 16777619u)
+  MIX(fields->type), MIX(fields->lower), MIX(fields->upper);
+  if (fields->type == TYPE_SYMSET)
+    for (int i = 0; i < sizeof fields->symset; i++)
+      MIX(fields->symset[i]);
+  for (struct regex **child = children; *child; child++)
+    MIX((*child)->hash);
+#undef MIX
+
+  hash ^= hash >> 16, hash *= 0x85ebca6bu;
+  hash ^= hash >> 13, hash *= 0xc2b2ae35u;
+  return hash ^ hash >> 16;
+}
+
+static bool regex_eq(struct regex *fields, struct regex *children[],
+                     struct regex *regex) {
+  // shallow structural equality. the children are interned, so comparing them
+  // by pointer amounts to deep structural equality
+
+  if (fields->hash != regex->hash || fields->type != regex->type ||
+      fields->lower != regex->lower || fields->upper != regex->upper)
+    return false;
+  if (fields->type == TYPE_SYMSET &&
+      memcmp(fields->symset, regex->symset, sizeof regex->symset) != 0)
+    return false;
+
+  struct regex **child1 = children, **child2 = regex->children;
+  for (; *child1 && *child1 == *child2; child1++, child2++)
+    ;
+  return *child1 == *child2;
+}
+
+static struct regex *regex_lookup(unsigned hash, size_t uid) {
+  // resolve a weak reference. return the regex with hash `hash` and unique
+  // identifier `uid` if it is still alive, or `NULL` otherwise. returns
+  // a borrowed regex
+
+  if (ctx->interned.cap)
+    for (size_t i = hash & ctx->interned.cap - 1; ctx->interned.slots[i];
+         i = i + 1 & ctx->interned.cap - 1)
+      if (ctx->interned.slots[i]->uid == uid)
+        return ctx->interned.slots[i];
+  return NULL;
+}
+
+static struct delta *deltas_slot(struct regex *regex, uint8_t cls) {
+  if (ctx->deltas.cap < ctx->interned.cap && ctx->deltas.cap < DELTAS_MAX_CAP) {
+    free(ctx->deltas.slots), ctx->deltas.cap = ctx->interned.cap;
+    ctx->deltas.slots = calloc(ctx->deltas.cap, sizeof *ctx->deltas.slots);
+  }
+  size_t i = (regex->hash ^ cls * 0x9e3779b9u) & ctx->deltas.cap - 1;
+  return &ctx->deltas.slots[i];
+}
+
+void regex_memo_stats(size_t *hits, size_t *misses) {
+  *hits = ctx->deltas.hits, *misses = ctx->deltas.misses;
+}
+
+static void regex_intern(struct regex *regex) {
+  if (2 * (ctx->interned.len + 1) > ctx->interned.cap) {
+    size_t cap = ctx->interned.cap ? 2 * ctx->interned.cap : 1024;
+    struct regex **slots = calloc(cap, sizeof *slots);
+    for (size_t i = 0; i < ctx->interned.cap; i++) {
+      if (!ctx->interned.slots[i])
+        continue;
+      size_t j = ctx->interned.slots[i]->hash & cap - 1;
+      while (slots[j])
+        j = j + 1 & cap - 1;
+      slots[j] = ctx->interned.slots[i];
+    }
+    free(ctx->interned.slots);
+    ctx->interned.slots = slots, ctx->interned.cap = cap;
+  }
+
+  size_t i = regex->hash & ctx->interned.cap - 1;
+  while (ctx->interned.slots[i])
+    i = i + 1 & ctx->interned.cap - 1;
+  ctx->interned.slots[i] = regex, ctx->interned.len++;
+}
+
+static void regex_evict(struct regex *regex) {
+  size_t i = regex->hash & ctx->interned.cap - 1;
+  while (ctx->interned.slots[i] != regex)
+    i = i + 1 & ctx->interned.cap - 1;
+
+  // backward-shift deletion, so we don't need tombstones. move entries back
+  // into the hole unless their home slot lies cyclically within `(i, j]`
+  for (size_t j = i; ctx->interned.slots[j = j + 1 & ctx->interned.cap - 1];) {
+    size_t home = ctx->interned.slots[j]->hash & ctx->interned.cap - 1;
+    if (i <= j ? i < home && home <= j : i < home || home <= j)
+      continue;
+    ctx->interned.slots[i] = ctx->interned.slots[j], i = j;
+  }
+  ctx->interned.slots[i] = NULL, ctx->interned.len--;
+}
+
+static void arena_release(void) {
+  for (void *block = ctx->arena.blocks, *next; block; block = next)
+    next = *(void **)block, free(block);
+  memset(&ctx->arena, 0x00, sizeof ctx->arena);
+}
+
+static void arena_begin(void) {
+  // the singletons live as long as the context, so make sure they're never
+  // pooled: an arena holding one of them would never be released
+  if (!ctx->arena.sessions)
+    regex_univ(), regex_negeps();
+  ctx->arena.sessions++;
+}
+
+static void arena_end(void) {
+  if (!--ctx->arena.sessions && !ctx->arena.live)
+    arena_release();
+}
+
+static struct regex *arena_alloc(size_t children_len) {
+  // returns `NULL` when the regex shouldn't be pooled
+  if (!ctx->arena.sessions || children_len >= ARENA_CLASSES)
+    return NULL;
+
+  size_t size = sizeof(struct regex) + (children_len + 1) * sizeof(void *);
+  void *regex = ctx->arena.free[children_len];
+  if (regex)
+    ctx->arena.free[children_len] = *(void **)regex;
+  else {
+    if ((size_t)(ctx->arena.end - ctx->arena.bump) < size) {
+      void *block = malloc(ARENA_BLOCK_SIZE);
+      *(void **)block = ctx->arena.blocks, ctx->arena.blocks = block;
+      // keep regexes aligned. `malloc` is suitably aligned for anything
+      ctx->arena.bump = (char *)block + sizeof(struct regex);
+      ctx->arena.end = (char *)block + ARENA_BLOCK_SIZE;
+    }
+    regex = ctx->arena.bump, ctx->arena.bump += size;
+  }
+  return ctx->arena.live++, regex;
+}
+
+static void arena_free(struct regex *regex, size_t children_len) {
+  *(void **)regex = ctx->arena.free[children_len];
+  ctx->arena.free[children_len] = regex;
+  if (!--ctx->arena.live && !ctx->arena.sessions)
+    arena_release(); // last pooled regex outlived its session
+}
+
+static struct regex **regexes_decref(struct regex *regexes[]);
 static struct regex *regex_alloc(struct regex fields,
                                  struct regex *children[]) {
+  // moves in `children`. return the interned regex with the given fields and
+  // children, allocating it if it doesn't already exist. derived fields like
+  // `size` and `nullable` are passed in too, but only written upon allocation:
+  // but for `refcount`, `visited` and `dclasses`, which are private to their
+  // context, regexes are immutable once interned. this lets other threads read
+  // them concurrently, as parallel determinization does
 #define regex_alloc(CHILDREN, ...)                                             \
   regex_alloc((struct regex){__VA_ARGS__}, CHILDREN)
-  size_t children_size = (regexes_len(children) + 1) * sizeof *children;
-  struct regex *regex = malloc(sizeof *regex + children_size);
+  fields.hash = regex_hash(&fields, children);
+
+  if (ctx->interned.cap)
+    for (size_t i = fields.hash & ctx->interned.cap - 1; ctx->interned.slots[i];
+         i = i + 1 & ctx->interned.cap - 1)
+      if (regex_eq(&fields, children, ctx->interned.slots[i]))
+        return regexes_decref(children), regex_incref(ctx->interned.slots[i]);
+
+  size_t children_len = regexes_len(children);
+  size_t children_size = (children_len + 1) * sizeof *children;
+  struct regex *regex = arena_alloc(children_len);
+  fields.pooled = regex != NULL;
+  if (!regex)
+    regex = malloc(sizeof *regex + children_size);
   *regex = fields, memcpy(regex->children, children, children_size);
+  regex->uid = ++ctx->interned.uid, regex_intern(regex);
+  ctx->bytes += sizeof *regex + children_size;
   return regex->refcount = 1, regex;
 }
 
@@ -162,9 +436,17 @@ struct regex *regex_decref(struct regex *regex) {
   // always returns `NULL` so you can go `regex = regex_decref(regex);`
   if (--regex->refcount)
     return NULL;
-  regexes_decref(regex->children);
-  if (regex->delta)
-    regex->delta = regex_decref(regex->delta);
+  // derivative classes may be borrowed from a child; see `regex_dclasses`
+  for (struct regex **child = regex->children; *child; child++)
+    if ((*child)->dclasses == regex->dclasses)
+      regex->dclasses = NULL;
+  regex_evict(regex), regexes_decref(regex->children);
+  ctx->bytes -= sizeof *regex + (regexes_len(regex->children) + 1) *
+                                    sizeof *regex->children;
+  if (regex->dclasses)
+    ctx->bytes -= sizeof *regex->dclasses, free(regex->dclasses);
+  if (regex->pooled)
+    return arena_free(regex, regexes_len(regex->children)), NULL;
   return free(regex), NULL;
 }
 
@@ -189,7 +471,9 @@ static int regexes_cmp(struct regex *regexes1[], struct regex *regexes2[]) {
 int regex_cmp(struct regex *regex1, struct regex *regex2) {
   // return an integer less than, equal to, or greater than zero if
   // `regex1` is, respectively, structurally less than, structurally equal
-  // to, or structurally greater than `regex2`. the ordering is arbitrary
+  // to, or structurally greater than `regex2`. the ordering is arbitrary.
+  // regexes are hash-consed so structural equality is pointer equality, and
+  // ordering distinct regexes only walks down to their first difference
 
   if (regex1 == regex2)
     return 0;
@@ -375,23 +659,23 @@ static char *regex_fmt(struct regex *regex, char *buf, enum regex_type prec) {
   return *buf = '\0', buf;
 }
 
-static struct regex **regexes_insert(struct regex *regexes[],
-                                     struct regex *elem) {
-  // insert borrowed element `elem` into the owned sorted array `regexes` if it
-  // is not already present
+static int regexes_order(const void *regex1, const void *regex2) {
+  // `qsort` comparator for children of commutative operators. they are kept in
+  // descending order, which is what normal forms have always used
+  return regex_cmp(*(struct regex **)regex2, *(struct regex **)regex1);
+}
 
-  // find the insertion spot
-  while (*regexes && regex_cmp(elem, *regexes) < 0)
-    regexes++;
-  struct regex **regex = regexes;
-  if (*regex && regex_cmp(elem, *regex) == 0)
-    return regexes; // `elem` already present
-  elem = regex_incref(elem);
-  // scooch remaining elements over
-  for (struct regex *temp; elem; regex++)
-    temp = *regex, *regex = elem, elem = temp;
-  *regex = elem;
-  return regexes;
+static size_t regexes_sort(struct regex *regexes[], size_t len) {
+  // sort the owned array `regexes` of length `len` and remove duplicates in
+  // place, in O(N log N). return the new length; the array isn't terminated
+  qsort(regexes, len, sizeof *regexes, regexes_order);
+  size_t uniq = 0;
+  for (size_t i = 0; i < len; i++)
+    if (uniq && regex_cmp(regexes[uniq - 1], regexes[i]) == 0)
+      regex_decref(regexes[i]);
+    else
+      regexes[uniq++] = regexes[i];
+  return uniq;
 }
 
 // smart constructors for `struct regex`. they return regular expressions
@@ -430,42 +714,47 @@ struct regex *regex_alt(struct regex *children[]) {
   if (negeps_child && !(nullable || eps_child))
     return regexes_decref(children), regex_negeps();
 
-  unsigned size = 1;
-  struct regex *flat_children[flat_len + 1];
-  *flat_children = NULL;
+  // huge alternations come from generated patterns, so keep them off the stack
+  struct regex *stack_children[64], **flat_children = stack_children;
+  if (flat_len >= sizeof stack_children / sizeof *stack_children)
+    flat_children = malloc((flat_len + 1) * sizeof *flat_children);
+  size_t len = 0;
   for (struct regex **child = children; *child; regex_decref(*child++)) {
     // r|() |- r, if nu(r)
     // ()|r |- r, if nu(r)
     if (nullable && *child == regex_eps())
       continue;
 
-    // r|r |- r
     // r|[] |- r
     // []|r |- r
     // r|(s|t) |- r|s|t
     // (r|s)|t |- r|s|t
-    // r|s |- s|r, if cmp(r, s) < 0
-    struct regex **flat_child = flat_children;
     struct regex **subchildren =
         (*child)->type == TYPE_ALT ? (*child)->children : REGEXES(*child);
     for (struct regex **subchild = subchildren; *subchild; subchild++)
-      flat_child = regexes_insert(flat_child, *subchild),
-      size += (*subchild)->size;
+      flat_children[len++] = regex_incref(*subchild);
   }
 
+  // r|r |- r
+  // r|s |- s|r, if cmp(r, s) < 0
+  len = regexes_sort(flat_children, len), flat_children[len] = NULL;
+  unsigned size = 1;
+  for (size_t i = 0; i < len; i++)
+    size += flat_children[i]->size;
+
   nullable |= eps_child; // include () children back
 
-  // [] |- []
+  struct regex *regex;
   if (!*flat_children)
-    return regex_empty();
-
-  // r |- r
-  if (!flat_children[1])
-    return *flat_children;
-
-  struct regex *regex =
-      regex_alloc(flat_children, TYPE_ALT, .nullable = nullable);
-  return regex->size = size, regex;
+    regex = regex_empty(); // [] |- []
+  else if (!flat_children[1])
+    regex = *flat_children; // r |- r
+  else
+    regex = regex_alloc(flat_children, TYPE_ALT, .nullable = nullable,
+                        .size = size);
+  if (flat_children != stack_children)
+    free(flat_children);
+  return regex;
 }
 
 struct regex *regex_compl(struct regex *child) {
@@ -485,9 +774,8 @@ struct regex *regex_compl(struct regex *child) {
   unsigned size = 1 + child->size;
   bool nullable = !child->nullable;
 
-  struct regex *regex =
-      regex_alloc(REGEXES(child), TYPE_COMPL, .nullable = nullable);
-  return regex->size = size, regex->nullable = nullable, regex;
+  return regex_alloc(REGEXES(child), TYPE_COMPL, .nullable = nullable,
+                     .size = size);
 }
 
 struct regex *regex_concat(struct regex *children[]) {
@@ -519,7 +807,10 @@ struct regex *regex_concat(struct regex *children[]) {
     return regexes_decref(children), regex_negeps();
 
   unsigned size = 1;
-  struct regex *flat_children[flat_len + 1], **flat_child = flat_children;
+  struct regex *stack_children[64], **flat_children = stack_children;
+  if (flat_len >= sizeof stack_children / sizeof *stack_children)
+    flat_children = malloc((flat_len + 1) * sizeof *flat_children);
+  struct regex **flat_child = flat_children;
   for (struct regex **child = children; *child; regex_decref(*child++)) {
     // r() |- r
     // ()r |- r
@@ -534,17 +825,17 @@ struct regex *regex_concat(struct regex *children[]) {
 
   nullable &= !negeps_child; // include (!) children back
 
-  // () |- ()
+  struct regex *regex;
   if (!*flat_children)
-    return regex_eps();
-
-  // r |- r
-  if (!flat_children[1])
-    return *flat_children;
-
-  struct regex *regex =
-      regex_alloc(flat_children, TYPE_CONCAT, .nullable = nullable);
-  return regex->size = size, regex;
+    regex = regex_eps(); // () |- ()
+  else if (!flat_children[1])
+    regex = *flat_children; // r |- r
+  else
+    regex = regex_alloc(flat_children, TYPE_CONCAT, .nullable = nullable,
+                        .size = size);
+  if (flat_children != stack_children)
+    free(flat_children);
+  return regex;
 }
 
 static struct regex *regex_repeat_prev(struct regex *prev, struct regex *child,
@@ -603,9 +894,8 @@ struct regex *regex_repeat(struct regex *child, unsigned lower,
   unsigned size = 1 + child->size;
   bool nullable = lower == 0 || child->nullable;
 
-  struct regex *regex = regex_alloc(REGEXES(child), TYPE_REPEAT, .lower = lower,
-                                    .upper = upper, .nullable = nullable);
-  return regex->size = size, regex;
+  return regex_alloc(REGEXES(child), TYPE_REPEAT, .lower = lower,
+                     .upper = upper, .nullable = nullable, .size = size);
 }
 
 struct regex *regex_symset(symset_t *symset) {
@@ -618,16 +908,18 @@ struct regex *regex_symset(symset_t *symset) {
   unsigned size = 1;
   bool nullable = false;
 
-  struct regex *regex = regex_alloc(REGEXES(NULL), TYPE_SYMSET, .upper = upper,
-                                    .nullable = nullable);
-  memcpy(regex->symset, *symset, sizeof *symset);
-  return regex->size = size, regex;
+  struct regex fields = {TYPE_SYMSET, .upper = upper, .nullable = nullable,
+                         .size = size};
+  memcpy(fields.symset, *symset, sizeof *symset);
+  // parenthesize to bypass the `regex_alloc` macro
+  return (regex_alloc)(fields, REGEXES(NULL));
 }
 
 // wrappers around the smart constructors, for structural recursion. when
 // calling the underlying smart constructor would yield a regular expression
-// that is structurally equal to `prev`, return `prev` instead. borrow `prev`
-// but move in `child` and `children`
+// that is structurally equal to `prev`, return `prev` instead. the smart
+// constructors would return `prev` anyway because of hash-consing, but this
+// way we skip normalization. borrow `prev` but move in `child` and `children`
 
 static struct regex *regex_alt_prev(struct regex *prev,
                                     struct regex *children[]) {
@@ -666,39 +958,66 @@ static struct regex *regex_symset_prev(struct regex *prev, symset_t *symset) {
 
 // shorthands for ALTs and CONCATs that have no children. equivalent to
 // calling the underlying smart constructors with `children = REGEXES(NULL)`.
-// they allocate memory once and always return the same pointers, which means
-// `regex_cmp` can report equality without a memory access
+// they allocate memory once per context and always return the same pointers,
+// which means they can be compared against by pointer
 
 struct regex *regex_empty(void) {
   // empty set regex /[]/
-  static struct regex *empty = NULL;
-  if (empty == NULL)
-    empty = regex_alloc(REGEXES(NULL), TYPE_ALT, .nullable = false);
-  return empty->refcount = INT_MAX, empty;
+  if (ctx->empty == NULL)
+    ctx->empty = regex_alloc(REGEXES(NULL), TYPE_ALT, .nullable = false);
+  return ctx->empty->refcount = INT_MAX, ctx->empty;
 }
 
 struct regex *regex_univ(void) {
   // universal set regex /%/
-  static struct regex *univ = NULL;
-  if (univ == NULL)
-    univ = regex_alloc(REGEXES(regex_empty()), TYPE_COMPL, .nullable = true);
-  return univ->refcount = INT_MAX, univ;
+  if (ctx->univ == NULL)
+    ctx->univ =
+        regex_alloc(REGEXES(regex_empty()), TYPE_COMPL, .nullable = true);
+  return ctx->univ->refcount = INT_MAX, ctx->univ;
 }
 
 struct regex *regex_eps(void) {
   // epsilon regex /()/
-  static struct regex *eps = NULL;
-  if (eps == NULL)
-    eps = regex_alloc(REGEXES(NULL), TYPE_CONCAT, .nullable = true);
-  return eps->refcount = INT_MAX, eps;
+  if (ctx->eps == NULL)
+    ctx->eps = regex_alloc(REGEXES(NULL), TYPE_CONCAT, .nullable = true);
+  return ctx->eps->refcount = INT_MAX, ctx->eps;
 }
 
 struct regex *regex_negeps(void) {
   // negated epsilon regex /(!)/
-  static struct regex *negeps = NULL;
-  if (negeps == NULL)
-    negeps = regex_alloc(REGEXES(regex_eps()), TYPE_COMPL, .nullable = false);
-  return negeps->refcount = INT_MAX, negeps;
+  if (ctx->negeps == NULL)
+    ctx->negeps =
+        regex_alloc(REGEXES(regex_eps()), TYPE_COMPL, .nullable = false);
+  return ctx->negeps->refcount = INT_MAX, ctx->negeps;
+}
+
+struct ltre_ctx *ltre_ctx_alloc(void) {
+  return calloc(1, sizeof(struct ltre_ctx));
+}
+
+struct ltre_ctx *ltre_ctx_use(struct ltre_ctx *new) {
+  struct ltre_ctx *old = ctx;
+  return ctx = new ? new : &default_ctx, old == &default_ctx ? NULL : old;
+}
+
+void ltre_ctx_free(struct ltre_ctx *free_ctx) {
+  // every regex of the context must have been freed already, save for the
+  // singletons, which we unpin then free along with their children. `free_ctx`
+  // must not be current in any other thread
+
+  struct ltre_ctx *old = ltre_ctx_use(free_ctx);
+  struct regex **singletons[] = {&ctx->univ, &ctx->empty, &ctx->negeps,
+                                 &ctx->eps};
+  for (int i = 0; i < 4; i++)
+    if (*singletons[i])
+      (*singletons[i])->refcount = 1;
+  for (int i = 0; i < 4; i += 2)
+    if (*singletons[i] || *singletons[i + 1])
+      regex_decref(*singletons[i] ? *singletons[i] : *singletons[i + 1]);
+
+  arena_release();
+  free(ctx->interned.slots), free(ctx->deltas.slots);
+  ltre_ctx_use(old == free_ctx ? NULL : old), free(free_ctx);
 }
 
 static struct regex *regex_ignorecase_ref(struct regex *regex, bool dual) {
@@ -780,31 +1099,156 @@ struct regex *regex_reverse(struct regex *regex) {
   return regex_decref(regex), temp;
 }
 
+static void dclasses_refine(struct dclasses *classes, symset_t symset) {
+  // split classes so that none straddles the boundary of `symset`
+  int renumber[512], len = 0;
+  for (int key = 0; key < 512; key++)
+    renumber[key] = -1;
+  for (int chr = 0; chr < 256; chr++) {
+    int key = classes->map[chr] << 1 | symset_read(symset, chr);
+    if (renumber[key] == -1)
+      renumber[key] = len++;
+    classes->map[chr] = renumber[key];
+  }
+  classes->len = len;
+}
+
+static void regex_refine(struct regex *regex, struct dclasses *classes) {
+  // refine `classes` using every symset of `regex`. marks regexes as visited
+  // so shared subexpressions are only gone through once. borrows its argument
+  if (regex->visited)
+    return;
+  regex->visited = true;
+  if (regex->type == TYPE_SYMSET)
+    dclasses_refine(classes, regex->symset);
+  for (struct regex **child = regex->children; *child; child++)
+    regex_refine(*child, classes);
+}
+
+static void regex_unrefine(struct regex *regex) {
+  // undo the marks left behind by `regex_refine` in time linear in the number
+  // of distinct subexpressions, unlike `regex_unmark`
+  if (!regex->visited)
+    return;
+  regex->visited = false;
+  for (struct regex **child = regex->children; *child; child++)
+    regex_unrefine(*child);
+}
+
+static struct dclasses *dclasses_meet(struct dclasses *classes1,
+                                      struct dclasses *classes2) {
+  // coarsest partition that is finer than both `classes1` and `classes2`.
+  // returns one of them if it happens to be the meet, else a new allocation
+  if (classes2->len == 1)
+    return classes1;
+  if (classes1->len == 1)
+    return classes2;
+
+  // chain together the classes of the meet that lie within the same class of
+  // `classes1`, so we can look up the class of the meet for a pair of classes
+  int len = 0, heads[256], nexts[256];
+  uint8_t keys[256];
+  for (int cls = 0; cls < classes1->len; cls++)
+    heads[cls] = -1;
+  struct dclasses *meet = malloc(sizeof *meet);
+  for (int chr = 0; chr < 256; chr++) {
+    int cls1 = classes1->map[chr], cls2 = classes2->map[chr], cls;
+    for (cls = heads[cls1]; cls != -1 && keys[cls] != cls2; cls = nexts[cls])
+      ;
+    if (cls == -1)
+      cls = len++, keys[cls] = cls2, nexts[cls] = heads[cls1],
+      heads[cls1] = cls;
+    meet->map[chr] = cls;
+  }
+  meet->len = len;
+
+  if (len == classes1->len)
+    return free(meet), classes1;
+  if (len == classes2->len)
+    return free(meet), classes2;
+  return meet;
+}
+
+static struct dclasses *regex_dclasses(struct regex *regex) {
+  // derivative classes of `regex`, after Owens, Reppy and Turon: a partition
+  // of the input characters such that characters of the same class yield the
+  // same derivative. usually much coarser than the classes of a whole DFA, so
+  // a DFA state needs only one derivative per derivative class of its regex.
+  // memoized on every subexpression, and shared with a child whenever possible
+  // so most regexes don't own theirs; see `regex_decref`. borrows its argument
+
+  if (regex->dclasses)
+    return regex->dclasses;
+
+  if (regex->type == TYPE_SYMSET) {
+    struct dclasses *classes = malloc(sizeof *classes);
+    *classes = (struct dclasses){.len = 1};
+    dclasses_refine(classes, regex->symset);
+    ctx->bytes += sizeof *classes;
+    return regex->dclasses = classes;
+  }
+
+  // the derivative of a concatenation only depends on its leading children,
+  // up to and including the first non-nullable one. children very often share
+  // their derivative classes, so skip over the ones we've already met with
+  struct dclasses *classes = NULL, *met[16];
+  int met_len = 0;
+  bool owned = false;
+  for (struct regex **child = regex->children; *child; child++) {
+    struct dclasses *child_classes = regex_dclasses(*child);
+    bool seen = false;
+    for (int i = 0; i < met_len; i++)
+      seen |= met[i] == child_classes;
+    if (!seen && met_len < sizeof met / sizeof *met)
+      met[met_len++] = child_classes;
+
+    struct dclasses *meet = !classes ? child_classes
+                            : seen   ? classes
+                                     : dclasses_meet(classes, child_classes);
+    if (owned && meet != classes)
+      free(classes);
+    owned = meet == classes ? owned : meet != child_classes;
+    classes = meet;
+    if (regex->type == TYPE_CONCAT && !(*child)->nullable)
+      break;
+  }
+
+  if (!classes) // epsilon
+    classes = malloc(sizeof *classes), *classes = (struct dclasses){.len = 1},
+    owned = true;
+  if (owned)
+    ctx->bytes += sizeof *classes;
+  return regex->dclasses = classes;
+}
+
 static struct regex *regex_differentiate_ref(struct regex *regex, uint8_t chr) {
-  // differentiate `regex` with respect to `chr`. borrows its argument. caches
-  // the derivative it returns in `regex->delta`.
+  // differentiate `regex` with respect to `chr`. borrows its argument. memoizes
+  // the derivative it returns in `deltas` for the whole derivative class of
+  // `chr`.
   // a derivative of a regular expression with respect to a symbol is any
   // regular expression that accepts exactly the strings that, if prepended by
   // the symbol, would have been accepted by the original regular expression
 
-  if (regex->delta && symset_read(regex->symset, chr) == regex->sym_incl)
-    return regex_incref(regex->delta); // cache hit
+  struct regex *delta;
+  uint8_t cls = regex_dclasses(regex)->map[chr];
+  struct delta *slot = deltas_slot(regex, cls);
+  if (slot->uid == regex->uid && slot->cls == cls)
+    if (delta = regex_lookup(slot->delta_hash, slot->delta_uid))
+      return ctx->deltas.hits++, regex_incref(delta); // memo hit
+  ctx->deltas.misses++;
 
   struct regex *children[regexes_len(regex->children) + 1];
   memcpy(children, regex->children, sizeof children);
 
-  struct regex *delta = regex->delta ? regex->delta : regex_empty();
-
-  // compute the derivative of `regex` and store into `regex->delta`
+  // compute the derivative of `regex` and store into `delta`
   switch (regex->type) {
   case TYPE_ALT:
     for (struct regex **child = children; *child; child++)
       *child = regex_differentiate_ref(*child, chr);
-    regex->delta = regex_alt_prev(delta, children);
+    delta = regex_alt(children);
     break;
   case TYPE_COMPL:
-    regex->delta =
-        regex_compl_prev(delta, regex_differentiate_ref(*children, chr));
+    delta = regex_compl(regex_differentiate_ref(*children, chr));
     break;
   case TYPE_CONCAT:
     // this is a little mind-bendy. for each child, we differentiate it in-
@@ -819,64 +1263,34 @@ static struct regex *regex_differentiate_ref(struct regex *regex, uint8_t chr) {
       if (!nullable)
         child[1] = NULL;
     }
-    regex->delta = regex_alt_prev(delta, children);
+    delta = regex_alt(children);
     break;
   case TYPE_REPEAT:
     if (regex->upper == 1)
-      regex->delta = regex_differentiate_ref(*children, chr);
+      delta = regex_differentiate_ref(*children, chr);
     else {
       unsigned lower = regex->lower, upper = regex->upper;
-      regex->delta = regex_concat(REGEXES( //
+      delta = regex_concat(REGEXES( //
           regex_differentiate_ref(*children, chr),
-          regex_repeat_prev(delta, regex_incref(*children),
-                            lower - (lower != 0), upper - !!upper)));
-    }
-    break;
-  case TYPE_SYMSET:
-    regex->delta =
-        symset_read(regex->symset, chr) ? regex_eps() : regex_empty();
-  }
-
-  regex_decref(delta);
-
-  // come up with a conservative set of characters for which `regex->delta`
-  // holds and store into `regex->symset`
-  switch (regex->type) {
-  case TYPE_ALT:
-  case TYPE_CONCAT:
-    regex->sym_incl = true;
-    memset(regex->symset, 0xff, sizeof regex->symset);
-    for (struct regex **child = regex->children; *child; child++) {
-      for (int i = 0; i < sizeof regex->symset; i++)
-        regex->symset[i] &=
-            (*child)->symset[i] ^ (unsigned)(*child)->sym_incl - 1;
-      if (regex->type == TYPE_CONCAT && !(*child)->nullable)
-        break;
+          regex_repeat(regex_incref(*children), lower - (lower != 0),
+                       upper - !!upper)));
     }
     break;
-  case TYPE_COMPL:
-  case TYPE_REPEAT:
-    // child is unique so we can use a fast `memcpy` and inherit `sym_incl`
-    // instead of conditionally inverting like we do above
-    regex->sym_incl = (*regex->children)->sym_incl;
-    memcpy(regex->symset, (*regex->children)->symset, sizeof regex->symset);
-    break;
   case TYPE_SYMSET:
-    regex->sym_incl = symset_read(regex->symset, chr);
+    delta = symset_read(regex->symset, chr) ? regex_eps() : regex_empty();
   }
 
-  // reflexivity invariant: `chr` should always be a member of the conservative
-  // set of characters for which the derivative with respect to `chr` holds
-  if (symset_read(regex->symset, chr) != regex->sym_incl)
-    abort();
+  // differentiating children may have grown the memo, so look up the slot anew
+  slot = deltas_slot(regex, cls);
+  *slot = (struct delta){regex->uid, delta->uid, delta->hash, cls};
 
   // printf("wrt 0x%02hhx\n", chr);
   // regex_unmark(regex);
   // regex_dump(regex, 0);
-  // regex_unmark(regex->delta);
-  // regex_dump(regex->delta, 0);
+  // regex_unmark(delta);
+  // regex_dump(delta, 0);
 
-  return regex_incref(regex->delta);
+  return delta;
 }
 
 struct regex *regex_differentiate(struct regex *regex, uint8_t chr) {
@@ -888,16 +1302,68 @@ struct regex *regex_differentiate(struct regex *regex, uint8_t chr) {
 // as a DFA, the first element of the linked list of states formed by `next` is
 // the initial state and subsequent elements enumerate all remaining states
 struct dstate {
-  struct dstate *transitions[256]; // indexed by input characters
-  bool accepting, terminating;     // for match result and early termination
-  int id;              // populated and used for various purposes throughout
-  struct dstate *next; // linked list to keep track of all states of a DFA
-  struct regex *regex; // associated regular expression for determinization
+  bool accepting, terminating; // for match result and early termination
+  uint8_t nexits, exits[4];    // for skipping self-loops; see `dfa_accelerate`
+  int id;               // populated and used for various purposes throughout
+  struct dstate *next;  // linked list to keep track of all states of a DFA
+  struct regex *regex;  // associated regular expression for determinization
+  struct dindex *index; // only on initial states of partial DFAs; see below
+  struct dclasses *classes; // see `struct dclasses`
+  struct dstate *transitions[]; // indexed by `classes->map[chr]`
 };
 
-struct dstate *dstate_alloc(struct regex *regex) {
-  struct dstate *dstate = malloc(sizeof *dstate);
-  *dstate = (struct dstate){.id = -1};
+// index of the states of a partial DFA keyed on their associated regular
+// expressions, so `dfa_step` can find a target state in expected constant
+// time. regexes are hash-consed so we key on pointers and probe using the
+// structural hash that was computed upon construction. open addressing with
+// linear probing, kept at most half full. also keeps track of the last state
+// of the linked list so new states can be appended in constant time
+struct dindex {
+  struct dstate *tail;
+  size_t len, cap; // `cap` is a power of two
+  struct dstate *slots[];
+};
+
+static struct dindex *dindex_insert(struct dindex *index,
+                                    struct dstate *dstate) {
+  // insert `dstate` into `index`, which must not already contain a state with
+  // the same regex. `index` may be `NULL`. returns the new index
+
+  if (!index || 2 * (index->len + 1) > index->cap) {
+    size_t cap = index ? 2 * index->cap : 64;
+    struct dindex *new = malloc(sizeof *new + cap * sizeof *new->slots);
+    *new = (struct dindex){.cap = cap};
+    memset(new->slots, 0x00, cap * sizeof *new->slots);
+    for (size_t i = 0; index && i < index->cap; i++)
+      if (index->slots[i])
+        new = dindex_insert(new, index->slots[i]);
+    if (index)
+      new->tail = index->tail;
+    free(index), index = new;
+  }
+
+  size_t i = dstate->regex->hash & index->cap - 1;
+  while (index->slots[i])
+    i = i + 1 & index->cap - 1;
+  index->slots[i] = dstate, index->len++;
+  return index;
+}
+
+static struct dstate *dindex_find(struct dindex *index, struct regex *regex) {
+  for (size_t i = regex->hash & index->cap - 1; index->slots[i];
+       i = i + 1 & index->cap - 1)
+    if (index->slots[i]->regex == regex)
+      return index->slots[i];
+  return NULL;
+}
+
+static struct dstate *dstate_new(struct regex *regex,
+                                 struct dclasses *classes) {
+  // allocate a state with `classes->len` null transitions
+  size_t transitions_size = classes->len * sizeof(struct dstate *);
+  struct dstate *dstate = malloc(sizeof *dstate + transitions_size);
+  *dstate = (struct dstate){.id = -1, .classes = classes};
+  memset(dstate->transitions, 0x00, transitions_size);
   // a DFA state is accepting if and only if its corresponding regular
   // expression accepts the empty word
   if (dstate->regex = regex)
@@ -905,10 +1371,22 @@ struct dstate *dstate_alloc(struct regex *regex) {
   return dstate;
 }
 
+struct dstate *dstate_alloc(struct regex *regex) {
+  // allocate the initial state of a DFA, computing its character classes from
+  // `regex`. takes ownership of `regex`
+  struct dclasses *classes = malloc(sizeof *classes);
+  *classes = (struct dclasses){.len = 1};
+  regex_refine(regex, classes), regex_unrefine(regex);
+  return dstate_new(regex, classes);
+}
+
 void dfa_free(struct dstate *dstate) {
+  if (dstate)
+    free(dstate->classes);
   for (struct dstate *next; dstate; dstate = next) {
     if (dstate->regex)
       dstate->regex = regex_decref(dstate->regex);
+    free(dstate->index);
     next = dstate->next, free(dstate);
   }
 }
@@ -923,8 +1401,18 @@ int dfa_get_size(struct dstate *dfa) {
   return dfa_size;
 }
 
+static void dfa_classes(struct dstate *dfa, symset_t symsets[]) {
+  // populate `symsets[cls]` with the input characters in class `cls`
+  memset(symsets, 0x00, dfa->classes->len * sizeof *symsets);
+  for (int chr = 0; chr < 256; chr++)
+    symset_write(symsets[dfa->classes->map[chr]], chr, true);
+}
+
 struct dstate *dfa_dump(struct dstate *dfa) {
   (void)dfa_get_size(dfa);
+  int len = dfa->classes->len;
+  symset_t symsets[len];
+  dfa_classes(dfa, symsets);
 
   printf("graph LR\n");
   printf("  I( ) --> %d\n", dfa->id);
@@ -936,9 +1424,10 @@ struct dstate *dfa_dump(struct dstate *dfa) {
     for (struct dstate *ds2 = dfa; ds2; ds2 = ds2->next) {
       bool empty = true;
       symset_t transitions = {0};
-      for (int chr = 0; chr < 256; chr++)
-        if (ds1->transitions[chr] == ds2)
-          symset_write(transitions, chr, true), empty = false;
+      for (int cls = 0; cls < len; cls++)
+        if (ds1->transitions[cls] == ds2)
+          for (int i = 0; i < sizeof transitions; i++)
+            transitions[i] |= symsets[cls][i], empty = false;
 
       if (empty)
         continue;
@@ -954,6 +1443,24 @@ struct dstate *dfa_dump(struct dstate *dfa) {
   return dfa;
 }
 
+static void dfa_accelerate(struct dstate *dfa) {
+  // find "accelerated" states: nonterminating states that loop back onto
+  // themselves on all but at most three input characters, such as the states
+  // within /%/ or /~\n*/. their `exits` are those characters in increasing
+  // order and followed by a zero byte, so matchers can skip runs of self-loops
+  // with `memchr` and friends rather than step through every character.
+  // `nexits` is zero for every other state. `dfa` must be marked
+  uint8_t *map = dfa->classes->map;
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
+    int nexits = 0;
+    for (int chr = 0; chr < 256 && nexits <= 3; chr++)
+      if (dstate->transitions[map[chr]] != dstate)
+        nexits < 3 ? dstate->exits[nexits] = chr : 0, nexits++;
+    dstate->nexits = nexits <= 3 && !dstate->terminating ? nexits : 0;
+    dstate->exits[dstate->nexits] = '\0';
+  }
+}
+
 static void leb128_put(uint8_t **p, int n) {
   while (n >> 7)
     *(*p)++ = (n & 0x7f) | 0x80, n >>= 7;
@@ -972,7 +1479,7 @@ static int leb128_get(uint8_t **p) {
 uint8_t *dfa_serialize(struct dstate *dfa, size_t *size) {
   // serialize a DFA using a mix of RLE and LEB128. `size` is an out parameter
 
-  int dfa_size = dfa_get_size(dfa);
+  int dfa_size = dfa_get_size(dfa), len = dfa->classes->len;
 
   // len(leb128(dfa_size)) == floor(log128(dfa_size) + 1)
   int log128p1 = 0;
@@ -980,25 +1487,34 @@ uint8_t *dfa_serialize(struct dstate *dfa, size_t *size) {
     log128p1++;
   log128p1++;
 
-  uint8_t *image = malloc(log128p1), *p = image;
+  // <leb128(dfa_size)> + 256 * (<run_length> + <class>)
+  uint8_t *image = malloc(log128p1 + 256 * 2), *p = image;
   leb128_put(&p, dfa_size);
 
+  for (int chr = 0; chr < 256;) {
+    int start = chr;
+    while (chr < 255 && dfa->classes->map[chr] == dfa->classes->map[chr + 1])
+      chr++;
+    *p++ = chr - start; // run length
+    *p++ = dfa->classes->map[chr++];
+  }
+
   for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
-    // ensure buffer large enough for worst case. worst case is typically around
-    // 500 bytes larger than best case, so this is not too wasteful.
-    ptrdiff_t len = p - image;
-    // len + <accepting_terminating> + 256 * (<run_length> + <leb128(dfa_size)>)
-    uint8_t *new = realloc(image, len + 1 + 256 * (1 + log128p1));
-    image = new, p = new + len;
+    // ensure buffer large enough for worst case. worst case is typically
+    // around twice as large as best case, so this is not too wasteful.
+    ptrdiff_t size = p - image;
+    // size + <accepting_terminating> + len * (<run_length> + <leb128(dfa_size)>)
+    uint8_t *new = realloc(image, size + 1 + len * (1 + log128p1));
+    image = new, p = new + size;
 
     *p++ = dstate->accepting << 1 | dstate->terminating;
-    for (int chr = 0; chr < 256;) {
-      int start = chr;
-      while (chr < 255 &&
-             dstate->transitions[chr] == dstate->transitions[chr + 1])
-        chr++;
-      *p++ = chr - start; // run length
-      leb128_put(&p, dstate->transitions[chr++]->id);
+    for (int cls = 0; cls < len;) {
+      int start = cls;
+      while (cls < len - 1 &&
+             dstate->transitions[cls] == dstate->transitions[cls + 1])
+        cls++;
+      *p++ = cls - start; // run length
+      leb128_put(&p, dstate->transitions[cls++]->id);
     }
   }
 
@@ -1012,18 +1528,29 @@ struct dstate *dfa_deserialize(uint8_t *image, size_t *size) {
   uint8_t *p = image;
   int dfa_size = leb128_get(&p);
 
+  struct dclasses *classes = malloc(sizeof *classes);
+  *classes = (struct dclasses){.len = 0};
+  for (int chr = 0; chr < 256;) {
+    int len = *p++;
+    do // run length
+      classes->map[chr++] = *p;
+    while (len--);
+    if (*p++ >= classes->len)
+      classes->len = p[-1] + 1;
+  }
+
   struct dstate *dstates[dfa_size];
   for (int id = 0; id < dfa_size; id++)
-    dstates[id] = dstate_alloc(NULL);
+    dstates[id] = dstate_new(NULL, classes);
 
   for (int id = 0; id < dfa_size; id++) {
     dstates[id]->accepting = *p >> 1 & 1;
     dstates[id]->terminating = *p++ & 1;
-    for (int chr = 0; chr < 256;) {
+    for (int cls = 0; cls < classes->len;) {
       int len = *p++;
       struct dstate *target = dstates[leb128_get(&p)];
       do // run length
-        dstates[id]->transitions[chr++] = target;
+        dstates[id]->transitions[cls++] = target;
       while (len--);
     }
 
@@ -1032,94 +1559,178 @@ struct dstate *dfa_deserialize(uint8_t *image, size_t *size) {
   }
 
   *size = p - image;
-  return *dstates;
+  return dfa_accelerate(*dstates), *dstates;
+}
+
+static int *dfa_predecessors(struct dstate *dfa, int dfa_size, int **first) {
+  // reverse transition index, in compressed sparse row form: the states with
+  // a transition into state `id` are `srcs[(*first)[id]..(*first)[id + 1]]`,
+  // by identifier, once per character class. `dstate.id` must be populated.
+  // returns `srcs`; free both arrays when done
+  int len = dfa->classes->len;
+  int *srcs = malloc(sizeof *srcs * dfa_size * len);
+  *first = calloc(dfa_size + 1, sizeof **first);
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    for (int cls = 0; cls < len; cls++)
+      (*first)[dstate->transitions[cls]->id + 1]++;
+  for (int id = 0; id < dfa_size; id++)
+    (*first)[id + 1] += (*first)[id];
+  int *fill = malloc(sizeof *fill * dfa_size);
+  memcpy(fill, *first, sizeof *fill * dfa_size);
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    for (int cls = 0; cls < len; cls++)
+      srcs[fill[dstate->transitions[cls]->id]++] = dstate->id;
+  return free(fill), srcs;
 }
 
 void dfa_mark(struct dstate *dfa) {
   // mark "terminating" states. calling `dfa_minimize` before or after calling
   // this function would be redundant. modifies `dfa` in-place
 
-  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
-    dstate->terminating = true;
-
   // flag "terminating" states. a terminating state is a state which either
-  // always or never leads to an accepting state. a state is terminating if and
-  // only if all its transitions are terminating and have the same `accepting`
-  // value as that state. to avoid having to deal with cycles, we default to all
-  // states being terminating then iteratively rule out the ones that aren't.
-  for (bool done = false; done = !done;)
-    for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
-      if (dstate->terminating)
-        for (int chr = 0; chr < 256; chr++)
-          if (dstate->accepting != dstate->transitions[chr]->accepting ||
-              !dstate->transitions[chr]->terminating)
-            dstate->terminating = false, done = false;
+  // always or never leads to an accepting state, that is, an "always
+  // accepting" state or a dead state, depending on its `accepting` value. a
+  // state isn't terminating if and only if it can reach a transition between
+  // an accepting and a non-accepting state, so we seed a worklist with the
+  // sources of such transitions and walk transitions backwards from there. the
+  // whole thing takes time linear in the number of transitions
+  int dfa_size = dfa_get_size(dfa), *first;
+  int *srcs = dfa_predecessors(dfa, dfa_size, &first);
+  struct dstate **dstates = malloc(sizeof *dstates * dfa_size);
+  int *worklist = malloc(sizeof *worklist * dfa_size), len = 0;
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
+    dstates[dstate->id] = dstate, dstate->terminating = true;
+    for (int cls = 0; cls < dfa->classes->len && dstate->terminating; cls++)
+      if (dstate->accepting != dstate->transitions[cls]->accepting)
+        dstate->terminating = false, worklist[len++] = dstate->id;
+  }
+
+  while (len) {
+    int id = worklist[--len];
+    for (int i = first[id]; i < first[id + 1]; i++)
+      if (dstates[srcs[i]]->terminating)
+        dstates[srcs[i]]->terminating = false, worklist[len++] = srcs[i];
+  }
 
+  free(srcs), free(first), free(dstates), free(worklist);
+  dfa_accelerate(dfa);
   // dfa_dump(dfa);
 }
 
-void dfa_minimize(struct dstate *dfa) {
-  // minimize `dfa` and mark "terminating" states. minimal DFAs are unique up to
-  // renumbering. calling `dfa_mark` before or after calling this function would
-  // be redundant
+// refinable partition of the integers `0..len`, after Valmari and Lehtinen.
+// `elems` is a permutation of `0..len` in which every set occupies a range
+// `first[set]..past[set]`, and `loc` is the inverse permutation of `elems`.
+// `set` maps every integer to the set containing it. to split sets, `mark`
+// some integers then call `partition_split`: every set containing both marked
+// and unmarked integers gets split in two, and the smaller half becomes a new
+// set numbered `nsets - 1`. this is what makes partition refinement run in
+// O(n log n)
+struct partition {
+  int nsets, *elems, *loc, *set, *first, *past;
+  int *marked, *touched, ntouched; // per-set mark counts, sets with marks
+};
 
-  int dfa_size = dfa_get_size(dfa);
-  struct dstate **dstates =
-      malloc(sizeof *dstates * dfa_size); // VLA is 35% slower
+static void partition_init(struct partition *p, int len) {
+  int *ints = malloc(sizeof *ints * len * 7);
+  *p = (struct partition){.nsets = len != 0};
+  p->elems = ints, p->loc = ints + len, p->set = ints + len * 2;
+  p->first = ints + len * 3, p->past = ints + len * 4;
+  p->marked = ints + len * 5, p->touched = ints + len * 6;
+  for (int elem = 0; elem < len; elem++)
+    p->elems[elem] = p->loc[elem] = elem, p->set[elem] = p->marked[elem] = 0;
+  if (len)
+    p->first[0] = 0, p->past[0] = len;
+}
+
+static void partition_mark(struct partition *p, int elem) {
+  // move `elem` into the marked prefix of its set
+  int set = p->set[elem], i = p->loc[elem], j = p->first[set] + p->marked[set];
+  if (i < j)
+    return; // already marked
+  p->elems[i] = p->elems[j], p->loc[p->elems[i]] = i;
+  p->elems[j] = elem, p->loc[elem] = j;
+  if (!p->marked[set]++)
+    p->touched[p->ntouched++] = set;
+}
+
+static void partition_split(struct partition *p) {
+  while (p->ntouched) {
+    int set = p->touched[--p->ntouched], j = p->first[set] + p->marked[set];
+    if (j != p->past[set]) {
+      int new = p->nsets++;
+      if (p->marked[set] <= p->past[set] - j)
+        p->first[new] = p->first[set], p->past[new] = p->first[set] = j;
+      else
+        p->past[new] = p->past[set], p->first[new] = p->past[set] = j;
+      for (int i = p->first[new]; i < p->past[new]; i++)
+        p->set[p->elems[i]] = new;
+      p->marked[new] = 0;
+    }
+    p->marked[set] = 0;
+  }
+}
+
+static int dfa_columns(struct dstate *dfa, int reps[], int group[]) {
+  // group together character classes on which all states transition to the
+  // same target state, so we can work with one representative per group and
+  // coarsen the character classes of the minimized DFA. we hash the columns
+  // of the transition table, tentatively group classes by hash, then confirm
+  // equality in a second pass. a class whose column turns out different from
+  // its group's just becomes its own representative, which is always sound.
+  // `group` maps classes to groups and `reps` groups to their smallest class.
+  // returns the number of groups. `dstate.id` must be populated
+
+  int len = dfa->classes->len, nreps = 0;
+  unsigned hashes[len];
+  memset(hashes, 0x00, sizeof hashes);
   for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
-    dstates[dstate->id] = dstate;
+    for (int cls = 0; cls < len; cls++)
+      hashes[cls] = (hashes[cls] ^ dstate->transitions[cls]->id) * 16777619u;
+  for (int cls = 0; cls < len; cls++)
+    for (group[cls] = 0; hashes[group[cls]] != hashes[cls];)
+      group[cls]++;
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    for (int cls = 0; cls < len; cls++)
+      if (dstate->transitions[cls] != dstate->transitions[group[cls]])
+        group[cls] = cls;
+  for (int cls = 0; cls < len; cls++)
+    if (group[cls] == cls)
+      group[cls] = nreps, reps[nreps++] = cls;
+    else
+      group[cls] = group[group[cls]];
+  return nreps;
+}
 
-  // store distinguishability data in a symmetric matrix condensed using bitsets
-  uint8_t(*dis)[(dfa_size + 7) / 8] =
-      malloc(sizeof *dis * dfa_size); // VLA is 35% slower
-  memset(dis, 0x00, sizeof *dis * dfa_size);
-  // abuse `symset_read` and `symset_write`
-#define ARE_DIS(ID1, ID2) symset_read(dis[ID1], ID2)
-#define MAKE_DIS(ID1, ID2)                                                     \
-  symset_write(dis[ID1], ID2, true), symset_write(dis[ID2], ID1, true)
-
-  // flag indistinguishable states. two states are indistinguishable if and
-  // only if both states have the same `accepting` value and, were both states
-  // assumed indistinguishable, their transitions would be equal up to target
-  // state indistinguishability. to avoid dealing with cycles, we default to all
-  // states being indistinguishable then iteratively rule out the ones that
-  // aren't.
-  for (struct dstate *ds1 = dfa; ds1; ds1 = ds1->next)
-    for (struct dstate *ds2 = ds1->next; ds2; ds2 = ds2->next)
-      if (ds1->accepting != ds2->accepting)
-        MAKE_DIS(ds1->id, ds2->id);
-  for (bool done = false; done = !done;)
-    for (int id1 = 0; id1 < dfa_size; id1++)
-      for (int id2 = id1 + 1; id2 < dfa_size; id2++)
-        if (!ARE_DIS(id1, id2))
-          for (int chr = 0; chr < 256; chr++)
-            // use irreflexivity of distinguishability as a cheap precheck
-            if (dstates[id1]->transitions[chr] !=
-                dstates[id2]->transitions[chr])
-              // `ds1` and `ds2` have not been marked distinguishable so far, so
-              // the 'were both states assumed indistinguishable' bit is covered
-              if (ARE_DIS(dstates[id1]->transitions[chr]->id,
-                          dstates[id2]->transitions[chr]->id))
-                MAKE_DIS(id1, id2), done = false, chr = 256;
-
-  // minimize the DFA by merging indistinguishable states. no need to prune
-  // unreachable states because the construction used by `ltre_determinize`
-  // yields a DFA with no unreachable states
-  for (struct dstate *ds1 = dfa; ds1; ds1 = ds1->next) {
-    for (struct dstate *prev = ds1; prev; prev = prev->next) {
-      for (struct dstate *ds2; ds2 = prev->next;) {
-        if (ARE_DIS(ds1->id, ds2->id))
-          break;
+static void dfa_quotient(struct dstate *dfa, int block[], int nblocks,
+                         int reps[], int nreps, int group[]) {
+  // merge the states of `dfa` that `block` maps to the same block, given the
+  // groups of classes computed by `dfa_columns`, and mark terminating states.
+  // keep the first state of every block in list order and redirect transitions
+  // to those representatives, all in one pass. the initial state comes first
+  // so it stays put. no need to prune unreachable states because the
+  // construction used by `ltre_determinize` yields a DFA with no unreachable
+  // states. transitions are compacted down to one per group of classes.
+  // `reps` is increasing so compacting in-place is safe
+
+  struct dstate **kept = malloc(sizeof *kept * nblocks);
+  for (int b = 0; b < nblocks; b++)
+    kept[b] = NULL;
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    if (!kept[block[dstate->id]])
+      kept[block[dstate->id]] = dstate;
 
-        // states are indistinguishable. merge them
-        for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
-          for (int chr = 0; chr < 256; chr++)
-            if (dstate->transitions[chr] == ds2)
-              dstate->transitions[chr] = ds1;
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    if (kept[block[dstate->id]] == dstate)
+      for (int rep = 0; rep < nreps; rep++)
+        dstate->transitions[rep] =
+            kept[block[dstate->transitions[reps[rep]]->id]];
+  for (int chr = 0; chr < 256; chr++)
+    dfa->classes->map[chr] = group[dfa->classes->map[chr]];
+  dfa->classes->len = nreps;
 
-        prev->next = ds2->next, free(ds2);
-      }
-    }
+  for (struct dstate *ds1 = dfa; ds1; ds1 = ds1->next) {
+    for (struct dstate *ds2; (ds2 = ds1->next) && kept[block[ds2->id]] != ds2;)
+      ds1->next = ds2->next, free(ds2); // states are indistinguishable
 
     // flag "terminating" states. a terminating state is a state which either
     // always or never leads to an accepting state. since `ds1` is now
@@ -1127,19 +1738,341 @@ void dfa_minimize(struct dstate *dfa) {
     // all its transitions point to itself because, by definition, no other
     // state accepts the same set of words it does (either all or none)
     ds1->terminating = true;
-    for (int chr = 0; chr < 256; chr++)
-      if (ds1->transitions[chr] != ds1)
+    for (int cls = 0; cls < nreps; cls++)
+      if (ds1->transitions[cls] != ds1)
         ds1->terminating = false;
   }
 
-#undef ARE_DIS
-#undef MAKE_DIS
+  free(kept), dfa_accelerate(dfa);
+}
+
+static void dfa_refine(struct dstate *dfa, int initial[], int ninitial) {
+  // minimize `dfa` starting off from the partition of states `initial` into
+  // `ninitial` blocks, or from accepting versus non-accepting states if it is
+  // `NULL`. `initial` must be coarser than the final partition. we use the
+  // partition refinement algorithm of Valmari and Lehtinen, which runs in
+  // O(m log n) for `m` transitions and `n` states and refines a partition of
+  // states and a partition of transitions in tandem
+
+  int dfa_size = dfa_get_size(dfa);
+  struct dstate **dstates =
+      malloc(sizeof *dstates * dfa_size); // VLA is 35% slower
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    dstates[dstate->id] = dstate;
+
+  int len = dfa->classes->len, reps[len], group[len];
+  int nreps = dfa_columns(dfa, reps, group);
+
+  // transition `t` goes from state `t / nreps` to state `heads[t]` on input
+  // characters of class `reps[t % nreps]`. `in_trans[in_first[id]..in_first[id + 1]]`
+  // are the transitions going into state `id`
+  int ntrans = dfa_size * nreps;
+  int *heads = malloc(sizeof *heads * ntrans);
+  int *in_trans = malloc(sizeof *in_trans * ntrans);
+  int *in_first = malloc(sizeof *in_first * (dfa_size + 1));
+  memset(in_first, 0x00, sizeof *in_first * (dfa_size + 1));
+  for (int t = 0; t < ntrans; t++)
+    heads[t] = dstates[t / nreps]->transitions[reps[t % nreps]]->id,
+    in_first[heads[t]]++;
+  for (int id = 0; id < dfa_size; id++)
+    in_first[id + 1] += in_first[id];
+  for (int t = ntrans; t--;)
+    in_trans[--in_first[heads[t]]] = t;
+
+  // the partition of states starts off as accepting versus non-accepting,
+  // unless given. given blocks are laid out in order through a counting sort
+  struct partition blocks;
+  partition_init(&blocks, dfa_size);
+  if (initial) {
+    for (int id = 0; id < dfa_size; id++)
+      blocks.marked[initial[id]]++;
+    for (int set = 0, i = 0; set < ninitial; set++)
+      blocks.first[set] = blocks.past[set] = i, i += blocks.marked[set],
+      blocks.marked[set] = 0;
+    for (int id = 0; id < dfa_size; id++)
+      blocks.set[id] = initial[id], blocks.loc[id] = blocks.past[initial[id]]++,
+      blocks.elems[blocks.loc[id]] = id;
+    blocks.nsets = ninitial;
+  } else {
+    for (int id = 0; id < dfa_size; id++)
+      if (dstates[id]->accepting)
+        partition_mark(&blocks, id);
+    partition_split(&blocks);
+  }
+
+  // the partition of transitions, whose sets are called "cords", starts off
+  // grouped by character class
+  struct partition cords;
+  partition_init(&cords, ntrans), cords.nsets = nreps;
+  for (int rep = 0, i = 0; rep < nreps; rep++) {
+    cords.first[rep] = i, cords.marked[rep] = 0;
+    for (int id = 0; id < dfa_size; id++, i++) {
+      int t = id * nreps + rep;
+      cords.elems[i] = t, cords.loc[t] = i, cords.set[t] = rep;
+    }
+    cords.past[rep] = i;
+  }
+
+  // flag indistinguishable states. every cord splits blocks by the sources of
+  // its transitions, and every new block splits cords by the targets of their
+  // transitions. the first block never needs to split cords because every
+  // other block already does the job
+  for (int cord = 0, block = 1; cord < cords.nsets; cord++) {
+    for (int i = cords.first[cord]; i < cords.past[cord]; i++)
+      partition_mark(&blocks, cords.elems[i] / nreps);
+    partition_split(&blocks);
+
+    for (; block < blocks.nsets; block++) {
+      for (int i = blocks.first[block]; i < blocks.past[block]; i++) {
+        int id = blocks.elems[i];
+        for (int j = in_first[id]; j < in_first[id + 1]; j++)
+          partition_mark(&cords, in_trans[j]);
+      }
+      partition_split(&cords);
+    }
+  }
+
+  dfa_quotient(dfa, blocks.set, blocks.nsets, reps, nreps, group);
 
   // dfa_dump(dfa);
   // printf("%d -> %d\n", dfa_size, dfa_get_size(dfa));
 
-  free(dstates), free(dis);
+  free(blocks.elems), free(cords.elems);
+  free(heads), free(in_trans), free(in_first), free(dstates);
+}
+
+void dfa_minimize(struct dstate *dfa) {
+  // minimize `dfa` and mark "terminating" states. minimal DFAs are unique up to
+  // renumbering. calling `dfa_mark` before or after calling this function would
+  // be redundant
+  dfa_refine(dfa, NULL, 0);
+}
+
+#ifdef __unix__
+// parallel minimization, after Moore: refine the partition of states in
+// rounds, splitting every block by the blocks that the transitions of its
+// states lead to, until a round splits nothing. unlike the algorithm used by
+// `dfa_minimize`, which is inherently sequential, every round is O(m) work
+// that splits evenly across threads. each thread hashes the signatures of a
+// range of states, which are a state's block along with the blocks of its
+// transitions, and sorts them by owner. every worker then numbers the new
+// blocks among the states it owns, which it can do on its own because states
+// with distinct signatures never end up in the same block. owning states by
+// signature rather than by block spreads out large blocks too. rounds are
+// bounded by the length of the shortest word telling apart any two states,
+// which can be as long as there are states, so as soon as a round adds few
+// blocks, or after a while, we hand the partition reached so far over to the
+// algorithm of `dfa_minimize`, which refines it the rest of the way
+#define PMIN_MAX_ROUNDS 64
+#define PMIN_MIN_GROWTH 32 // give up on rounds adding under `1 / N` of blocks
+
+struct pmin {
+  int dfa_size, nreps, nblocks;
+  bool stable;        // whether the rounds refined the partition all the way
+  int *heads;         // transition targets, as in `dfa_minimize`
+  int *blocks[2];     // partition of states, before and after a round
+  int *local;         // new blocks, numbered locally to their worker
+  unsigned *sigs;     // hashes of the signatures of states
+  int *order;         // states of each range, grouped by owner
+  pthread_mutex_t lock; // guards the fields below
+  pthread_cond_t cond;
+  int workers_len;         // zero until every worker has been created
+  int waiting, generation; // see `pmin_wait`
+  struct pmin_worker {
+    struct pmin *pmin;
+    int count;   // new blocks, after a round
+    int *table;  // signatures to their first state, `-1` meaning empty
+    int cap;     // zero or a power of two
+    int *starts; // where the states it hashed for each owner begin in `order`
+  } workers[];
+};
+
+static void pmin_wait(struct pmin *pmin) {
+  // wait for every other worker to get here. `pthread_barrier_t` is only an
+  // optional part of POSIX
+  pthread_mutex_lock(&pmin->lock);
+  int generation = pmin->generation;
+  if (++pmin->waiting == pmin->workers_len)
+    pmin->waiting = 0, pmin->generation++, pthread_cond_broadcast(&pmin->cond);
+  while (generation == pmin->generation)
+    pthread_cond_wait(&pmin->cond, &pmin->lock);
+  pthread_mutex_unlock(&pmin->lock);
+}
+
+static bool pmin_equal(struct pmin *pmin, int *block, int id1, int id2) {
+  // whether states `id1` and `id2` stay in the same block this round
+  int *heads1 = pmin->heads + id1 * pmin->nreps;
+  int *heads2 = pmin->heads + id2 * pmin->nreps;
+  if (pmin->sigs[id1] != pmin->sigs[id2] || block[id1] != block[id2])
+    return false;
+  for (int rep = 0; rep < pmin->nreps; rep++)
+    if (block[heads1[rep]] != block[heads2[rep]])
+      return false;
+  return true;
+}
+
+static void pmin_split(struct pmin_worker *worker, int *block, int me) {
+  // number the new blocks among the states owned by worker `me`, through a
+  // hash table of signatures. open addressing with linear probing, kept at
+  // most half full
+  struct pmin *pmin = worker->pmin;
+  worker->count = 0;
+  if (worker->cap)
+    memset(worker->table, 0xff, worker->cap * sizeof *worker->table);
+
+  for (int w = 0; w < pmin->workers_len; w++) {
+    int *starts = pmin->workers[w].starts;
+    for (int k = starts[me]; k < starts[me + 1]; k++) {
+      int id = pmin->order[k];
+      if (2 * (worker->count + 1) > worker->cap) {
+        int cap = worker->cap ? 2 * worker->cap : 1024, *table = worker->table;
+        worker->table = malloc(cap * sizeof *table);
+        memset(worker->table, 0xff, cap * sizeof *table);
+        for (int i = 0; i < worker->cap; i++)
+          if (table[i] != -1) {
+            int j = pmin->sigs[table[i]] & cap - 1;
+            while (worker->table[j] != -1)
+              j = j + 1 & cap - 1;
+            worker->table[j] = table[i];
+          }
+        free(table), worker->cap = cap;
+      }
+
+      int i = pmin->sigs[id] & worker->cap - 1;
+      for (; worker->table[i] != -1; i = i + 1 & worker->cap - 1)
+        if (pmin_equal(pmin, block, worker->table[i], id))
+          break;
+      if (worker->table[i] == -1)
+        worker->table[i] = id, pmin->local[id] = worker->count++;
+      else
+        pmin->local[id] = pmin->local[worker->table[i]];
+    }
+  }
+}
+
+static void *pmin_work(void *arg) {
+  struct pmin_worker *worker = arg;
+  struct pmin *pmin = worker->pmin;
+  pthread_mutex_lock(&pmin->lock);
+  while (!pmin->workers_len)
+    pthread_cond_wait(&pmin->cond, &pmin->lock);
+  pthread_mutex_unlock(&pmin->lock);
+
+  int me = worker - pmin->workers, len = pmin->workers_len;
+  int lo = (long long)pmin->dfa_size * me / len;
+  int hi = (long long)pmin->dfa_size * (me + 1) / len;
+  worker->starts = malloc((len + 1) * sizeof *worker->starts);
+  for (int round = 0, nblocks = pmin->nblocks;; round++) {
+    int *block = pmin->blocks[round % 2], *next = pmin->blocks[!(round % 2)];
+
+    // hash the signatures of our share of states, then sort them by owner
+    int *starts = worker->starts, fill[len];
+    memset(starts, 0x00, (len + 1) * sizeof *starts);
+    for (int id = lo; id < hi; id++) {
+      unsigned hash = 2166136261u ^ block[id];
+      for (int *head = pmin->heads + id * pmin->nreps,
+               *end = head + pmin->nreps;
+           head < end; head++)
+        hash = (hash ^ block[*head]) * 16777619u;
+      hash ^= hash >> 16, hash *= 0x85ebca6bu;
+      pmin->sigs[id] = hash ^= hash >> 13;
+      starts[hash % len + 1]++;
+    }
+    starts[0] = lo;
+    for (int w = 0; w < len; w++)
+      fill[w] = starts[w], starts[w + 1] += starts[w];
+    for (int id = lo; id < hi; id++)
+      pmin->order[fill[pmin->sigs[id] % len]++] = id;
+    pmin_wait(pmin);
+
+    pmin_split(worker, block, me);
+    pmin_wait(pmin);
+
+    // number blocks globally, those of lower-numbered workers first
+    int bases[len], total = 0;
+    for (int w = 0; w < len; w++)
+      bases[w] = total, total += pmin->workers[w].count;
+    for (int id = lo; id < hi; id++)
+      next[id] = bases[pmin->sigs[id] % len] + pmin->local[id];
+    pmin_wait(pmin);
+
+    // every worker reaches the same verdict, as they all see the same counts
+    if (total == nblocks || total - nblocks < nblocks / PMIN_MIN_GROWTH ||
+        round == PMIN_MAX_ROUNDS - 1) {
+      if (me == 0)
+        pmin->blocks[0] = next, pmin->blocks[1] = block, pmin->nblocks = total,
+        pmin->stable = total == nblocks;
+      break;
+    }
+    nblocks = total;
+  }
+  return NULL;
+}
+
+void dfa_minimize_parallel(struct dstate *dfa, int threads) {
+  // like `dfa_minimize`, but across `threads` threads, the calling thread
+  // included. takes O(m) time per round for `m` transitions
+
+  if (threads <= 1) {
+    dfa_minimize(dfa);
+    return;
+  }
+
+  int dfa_size = dfa_get_size(dfa);
+  int len = dfa->classes->len, reps[len], group[len];
+  int nreps = dfa_columns(dfa, reps, group);
+
+  struct pmin *pmin = calloc(1, sizeof *pmin + threads * sizeof *pmin->workers);
+  pmin->dfa_size = dfa_size, pmin->nreps = nreps;
+  pmin->heads = malloc(sizeof *pmin->heads * dfa_size * nreps);
+  pmin->blocks[0] = malloc(sizeof *pmin->blocks[0] * dfa_size);
+  pmin->blocks[1] = malloc(sizeof *pmin->blocks[1] * dfa_size);
+  pmin->local = malloc(sizeof *pmin->local * dfa_size);
+  pmin->sigs = malloc(sizeof *pmin->sigs * dfa_size);
+  pmin->order = malloc(sizeof *pmin->order * dfa_size);
+  bool accepting[2] = {false, false};
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
+    for (int rep = 0; rep < nreps; rep++)
+      pmin->heads[dstate->id * nreps + rep] =
+          dstate->transitions[reps[rep]]->id;
+    pmin->blocks[0][dstate->id] = dstate->accepting;
+    accepting[dstate->accepting] = true;
+  }
+  pmin->nblocks = accepting[0] + accepting[1];
+
+  // threads that couldn't be created are left out before any work begins
+  pthread_mutex_init(&pmin->lock, NULL), pthread_cond_init(&pmin->cond, NULL);
+  pthread_t tids[threads];
+  int started = 1;
+  for (int i = 1; i < threads; i++) {
+    pmin->workers[started].pmin = pmin;
+    started += !pthread_create(&tids[started], NULL, pmin_work,
+                               &pmin->workers[started]);
+  }
+  pthread_mutex_lock(&pmin->lock);
+  pmin->workers_len = started;
+  pthread_cond_broadcast(&pmin->cond);
+  pthread_mutex_unlock(&pmin->lock);
+  pmin->workers->pmin = pmin, pmin_work(pmin->workers);
+  for (int i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  if (pmin->stable)
+    dfa_quotient(dfa, pmin->blocks[0], pmin->nblocks, reps, nreps, group);
+  else // carry on from where the rounds left off
+    dfa_refine(dfa, pmin->blocks[0], pmin->nblocks);
+
+  for (int i = 0; i < started; i++)
+    free(pmin->workers[i].table), free(pmin->workers[i].starts);
+  pthread_mutex_destroy(&pmin->lock), pthread_cond_destroy(&pmin->cond);
+  free(pmin->heads), free(pmin->blocks[0]), free(pmin->blocks[1]);
+  free(pmin->local), free(pmin->sigs), free(pmin->order), free(pmin);
 }
+#else
+void dfa_minimize_parallel(struct dstate *dfa, int threads) {
+  dfa_minimize(dfa); // no threads to speak of
+}
+#endif
 
 bool dfa_equivalent(struct dstate *dfa1, struct dstate *dfa2) {
   // check whether `dfa1` and `dfa2` accept the same language. both DFAs must be
@@ -1154,14 +2087,27 @@ bool dfa_equivalent(struct dstate *dfa1, struct dstate *dfa2) {
   for (int id = 0; id < dfa_size; id++)
     map[id] = NULL;
 
+  // the DFAs may have different character classes, so pick one representative
+  // input character per pair of classes and look up transitions through those
+  int nreps = 0;
+  uint8_t reps1[256], reps2[256];
+  symset_t seen[256] = {0}; // abuse `symset_t` as a bitset
+  for (int chr = 0; chr < 256; chr++) {
+    uint8_t cls1 = dfa1->classes->map[chr], cls2 = dfa2->classes->map[chr];
+    if (!symset_read(seen[cls1], cls2))
+      symset_write(seen[cls1], cls2, true), reps1[nreps] = cls1,
+                                            reps2[nreps++] = cls2;
+  }
+
   // come up with a tentative mapping by following transitions from the initial
   // states. the mapping will be nonesensical when the DFAs are not equivalent,
   // but that doesn't matter as long as the mapping is an isomorphism when the
   // DFAs actually are equivalent
   map[dfa1->id] = dfa2;
   for (struct dstate *dstate = dfa1; dstate; dstate = dstate->next)
-    for (int chr = 0; chr < 256; chr++)
-      map[dstate->transitions[chr]->id] = map[dstate->id]->transitions[chr];
+    for (int rep = 0; rep < nreps; rep++)
+      map[dstate->transitions[reps1[rep]]->id] =
+          map[dstate->id]->transitions[reps2[rep]];
 
   // now, ensure our tentative mapping is an isomorphism
   if (map[dfa1->id] != dfa2)
@@ -1171,27 +2117,552 @@ bool dfa_equivalent(struct dstate *dfa1, struct dstate *dfa2) {
       return false; // mapping is not a bijection
     if (dstate->accepting != map[dstate->id]->accepting)
       return false; // accepting states not preserved
-    for (int chr = 0; chr < 256; chr++)
-      if (map[dstate->transitions[chr]->id] !=
-          map[dstate->id]->transitions[chr])
+    for (int rep = 0; rep < nreps; rep++)
+      if (map[dstate->transitions[reps1[rep]]->id] !=
+          map[dstate->id]->transitions[reps2[rep]])
         return false; // transitions not preserved
   }
 
   return true;
 }
 
-// some invariants for parsers on parse error:
-//   - `error` shall be set to a non-`NULL` error message
-//   - `regex` shall point to the error location
-//   - the returned regular expression should be `NULL`
-//   - the caller is responsible for backtracking
+static uint8_t *dtable_shuffles(struct dtable *dtable) {
+  // the shuffle table, right past the records
+  size_t table_size = (size_t)dtable->size * dtable->stride * dtable->width;
+  return dtable->table + table_size + dtable->stop / dtable->stride * 4;
+}
 
-// keep in sync with grammar.bnf and ltre.vim
+static bool dtable_can_shuffle(void) {
+  // whether `dtable_shuffle` can run here. tables built elsewhere only get a
+  // shuffle table if it can, so that it isn't dead weight
+#ifdef X86_TARGET
+  return __builtin_cpu_supports("ssse3");
+#else
+  return false;
+#endif
+}
 
-static int parse_ws(char **pattern) {
-  while (isspace(**pattern))
-    ++*pattern;
-  return 1; // for use within &&
+static uint16_t *dtable_pairs(struct dtable *dtable) {
+  // the stride-2 table, past the shuffle table and aligned to two bytes
+  uint8_t *pairs = dtable_shuffles(dtable) + dtable->shuffles * 16;
+  return (uint16_t *)(pairs + (pairs - dtable->table) % 2);
+}
+
+struct dtable *dtable_alloc(struct dstate *dfa) {
+  // build a `struct dtable` from the complete DFA `dfa`. the DFA is left
+  // untouched and may be freed right away. states are grouped as accelerated
+  // rejecting, terminating rejecting, terminating accepting, accelerated
+  // accepting, other accepting, then other rejecting, preserving list order
+  // within each group
+
+  int dfa_size = dfa_get_size(dfa), stride = dfa->classes->len;
+  int counts[6] = {0}, firsts[7] = {0};
+  int *rows = malloc(dfa_size * sizeof *rows);
+  // group of each state; see above
+#define DTABLE_GROUP(DSTATE)                                                   \
+  ((DSTATE)->terminating ? 1 + (DSTATE)->accepting                             \
+   : (DSTATE)->nexits    ? 3 * (DSTATE)->accepting                             \
+                         : 5 - (DSTATE)->accepting)
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    counts[DTABLE_GROUP(dstate)]++;
+  for (int group = 0; group < 6; group++)
+    firsts[group + 1] = firsts[group] + counts[group];
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    rows[dstate->id] = firsts[DTABLE_GROUP(dstate)]++;
+  // `firsts[group]` now points past `group`
+#undef DTABLE_GROUP
+
+  // premultiplied identifiers range over `0..=(dfa_size - 1) * stride`
+  uint64_t max_id = (uint64_t)(dfa_size - 1) * stride;
+  if (max_id > UINT32_MAX)
+    abort();
+  int width = max_id <= UINT8_MAX ? 1 : max_id <= UINT16_MAX ? 2 : 4;
+  size_t table_size = (size_t)dfa_size * stride * width;
+  // the shuffle table has a row of 16 states per input character
+  int shuffles = dfa_size <= 16 && dtable_can_shuffle() ? 256 : 0;
+  size_t records_size = table_size + (size_t)firsts[3] * 4 + shuffles * 16;
+  // the stride-2 table squares the number of columns, so only small DFAs with
+  // few classes get one. those are the common case, and then it fits in cache
+  uint64_t pairs = (uint64_t)dfa_size * stride * stride;
+  if (pairs > DTABLE_PAIRS_MAX)
+    pairs = 0;
+  struct dtable *dtable =
+      malloc(sizeof *dtable + records_size +
+             (pairs ? records_size % 2 + pairs * sizeof(uint16_t) : 0));
+  *dtable = (struct dtable){
+      .magic = DTABLE_MAGIC,
+      .width = width,
+      .stride = stride,
+      .size = dfa_size,
+      .initial = rows[dfa->id] * stride,
+      .stop = firsts[3] * stride,
+      .term_lo = firsts[0] * stride,
+      .term_hi = firsts[2] * stride,
+      .accept_lo = firsts[1] * stride,
+      .accept_hi = firsts[4] * stride,
+      .pairs = pairs,
+      .shuffles = shuffles,
+  };
+  memcpy(dtable->map, dfa->classes->map, sizeof dtable->map);
+
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    for (int cls = 0; cls < stride; cls++) {
+      size_t idx = (size_t)rows[dstate->id] * stride + cls;
+      uint32_t id = rows[dstate->transitions[cls]->id] * stride;
+      dtable->width == 1   ? (((uint8_t *)dtable->table)[idx] = id)
+      : dtable->width == 2 ? (((uint16_t *)dtable->table)[idx] = id)
+                           : (((uint32_t *)dtable->table)[idx] = id);
+    }
+
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+    if (rows[dstate->id] < firsts[3]) {
+      uint8_t *record = dtable->table + table_size + rows[dstate->id] * 4;
+      *record = dstate->nexits, memcpy(record + 1, dstate->exits, 3);
+    }
+
+  uint8_t *shuffle = dtable_shuffles(dtable);
+  memset(shuffle, 0, shuffles * 16);
+  for (struct dstate *dstate = dfa; shuffles && dstate; dstate = dstate->next)
+    for (int chr = 0; chr < 256; chr++)
+      shuffle[chr * 16 + rows[dstate->id]] =
+          rows[dstate->transitions[dfa->classes->map[chr]]->id];
+
+  uint16_t *pair = dtable_pairs(dtable);
+  for (struct dstate *dstate = dfa; pairs && dstate; dstate = dstate->next)
+    for (int cls1 = 0; cls1 < stride; cls1++)
+      for (int cls2 = 0; cls2 < stride; cls2++) {
+        size_t idx = ((size_t)rows[dstate->id] * stride + cls1) * stride + cls2;
+        struct dstate *target = dstate->transitions[cls1]->transitions[cls2];
+        pair[idx] = rows[target->id] * stride * stride;
+      }
+
+  free(rows);
+  return dtable;
+}
+
+void dtable_free(struct dtable *dtable) {
+  // only for tables from `dtable_alloc`. images from `dtable_load` belong to
+  // whoever provided them
+  free(dtable);
+}
+
+size_t dtable_get_size(struct dtable *dtable) {
+  size_t table_size = (size_t)dtable->size * dtable->stride * dtable->width;
+  size_t records_size = table_size + dtable->stop / dtable->stride * 4 +
+                        dtable->shuffles * 16;
+  return sizeof *dtable + records_size +
+         (dtable->pairs ? records_size % 2 + dtable->pairs * sizeof(uint16_t)
+                        : 0);
+}
+
+struct dtable *dtable_load(uint8_t *image, size_t size, char **error) {
+  // validate the image `image..image + size` of a `struct dtable` and return
+  // it as-is, without copying. safe to use on untrusted images: on success,
+  // `dtable_run` and friends will never read outside of the image. on failure,
+  // sets `error` and returns `NULL`. `image` must stay alive and unmodified for
+  // as long as the returned table is in use
+
+  struct dtable *dtable = (struct dtable *)image;
+  if ((uintptr_t)image % sizeof(uint32_t) != 0)
+    return *error = "misaligned image", NULL;
+  if (size < sizeof *dtable)
+    return *error = "truncated image", NULL;
+  if (dtable->magic != DTABLE_MAGIC)
+    return *error = "bad magic or byte order", NULL;
+  if (dtable->width != 1 && dtable->width != 2 && dtable->width != 4)
+    return *error = "bad width", NULL;
+  if (dtable->stride < 1 || dtable->stride > 256 || dtable->size < 1)
+    return *error = "bad dimensions", NULL;
+  uint64_t ids = (uint64_t)dtable->size * dtable->stride;
+  if (ids - 1 > UINT32_MAX >> (32 - 8 * dtable->width))
+    return *error = "bad dimensions", NULL; // won't fit in `width` bytes
+  if (dtable->stop > ids || dtable->stop % dtable->stride != 0)
+    return *error = "state out of range", NULL;
+  if (dtable->pairs != 0 && (dtable->pairs != ids * dtable->stride ||
+                             dtable->pairs > DTABLE_PAIRS_MAX))
+    return *error = "bad dimensions", NULL;
+  if (dtable->shuffles != 0 &&
+      (dtable->shuffles != 256 || dtable->size > 16))
+    return *error = "bad dimensions", NULL;
+  uint64_t records_size = ids * dtable->width +
+                          dtable->stop / dtable->stride * 4 +
+                          dtable->shuffles * 16;
+  if (size != sizeof *dtable + records_size +
+                  (dtable->pairs ? records_size % 2 +
+                                       dtable->pairs * sizeof(uint16_t)
+                                 : 0))
+    return *error = "truncated image", NULL;
+
+  for (int chr = 0; chr < 256; chr++)
+    if (dtable->map[chr] >= dtable->stride)
+      return *error = "column out of range", NULL;
+  // every state identifier must be a row offset. the state ordering only
+  // affects match results, so there is nothing to check there besides bounds
+  uint32_t *ranges[] = {&dtable->initial,   &dtable->term_lo,
+                        &dtable->term_hi,   &dtable->accept_lo,
+                        &dtable->accept_hi, NULL};
+  for (uint32_t **range = ranges; *range; range++)
+    if (**range > ids || **range % dtable->stride != 0)
+      return *error = "state out of range", NULL;
+  if (dtable->initial == ids || dtable->accept_lo > dtable->accept_hi ||
+      dtable->term_lo > dtable->term_hi || dtable->term_hi > dtable->stop)
+    return *error = "state out of range", NULL;
+  // states below `stop` that aren't terminating are accelerated, and must have
+  // between one and three exit characters
+  uint8_t *records = dtable->table + ids * dtable->width;
+  for (uint32_t id = 0; id < dtable->stop; id += dtable->stride)
+    if (!dtable_terminating(dtable, id) &&
+        (records[id / dtable->stride * 4] - 1u > 2))
+      return *error = "bad exit characters", NULL;
+  for (size_t idx = 0; idx < ids; idx++) {
+    uint32_t id = dtable->width == 1   ? ((uint8_t *)dtable->table)[idx]
+                  : dtable->width == 2 ? ((uint16_t *)dtable->table)[idx]
+                                       : ((uint32_t *)dtable->table)[idx];
+    if (id >= ids || id % dtable->stride != 0)
+      return *error = "state out of range", NULL;
+  }
+  uint8_t *shuffles = dtable_shuffles(dtable);
+  for (uint32_t idx = 0; idx < dtable->shuffles * 16; idx++)
+    if (shuffles[idx] >= dtable->size)
+      return *error = "state out of range", NULL;
+  uint16_t *pairs = dtable_pairs(dtable);
+  for (uint32_t idx = 0; idx < dtable->pairs; idx++)
+    if (pairs[idx] >= dtable->pairs ||
+        pairs[idx] % (dtable->stride * dtable->stride) != 0)
+      return *error = "state out of range", NULL;
+
+  return dtable;
+}
+
+static uint8_t *dtable_skip(uint8_t *record, uint8_t *p, uint8_t *end,
+                            int eol) {
+  // find the first of the exit characters of `record` or of `eol` within
+  // `p..end`, or return `end`. a lone character is what `memchr` is for.
+  // otherwise compare whole vectors against all characters at once; the
+  // character set is padded with duplicates so the loops have a fixed shape
+  uint8_t needles[4];
+  int len = *record;
+  memcpy(needles, record + 1, len);
+  if (eol != EOF && !memchr(needles, eol, len))
+    needles[len++] = eol;
+  if (len == 1)
+    return (p = memchr(p, *needles, end - p)) ? p : end;
+  for (int i = len; i < 4; i++)
+    needles[i] = *needles;
+
+#ifdef __AVX2__
+  __m256i n0 = _mm256_set1_epi8(needles[0]), n1 = _mm256_set1_epi8(needles[1]),
+          n2 = _mm256_set1_epi8(needles[2]), n3 = _mm256_set1_epi8(needles[3]);
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)p);
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, n0), _mm256_cmpeq_epi8(v, n1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, n2), _mm256_cmpeq_epi8(v, n3))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+#ifdef __SSE2__
+  __m128i m0 = _mm_set1_epi8(needles[0]), m1 = _mm_set1_epi8(needles[1]),
+          m2 = _mm_set1_epi8(needles[2]), m3 = _mm_set1_epi8(needles[3]);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)p);
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, m0), _mm_cmpeq_epi8(v, m1)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, m2), _mm_cmpeq_epi8(v, m3))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+
+  for (; p < end; p++)
+    if (*p == needles[0] || *p == needles[1] || *p == needles[2] ||
+        *p == needles[3])
+      return p;
+  return end;
+}
+
+#ifdef X86_TARGET
+X86_TARGET("ssse3")
+static uint8_t *dtable_shuffle(struct dtable *dtable, size_t *state,
+                               uint8_t *p, uint8_t *end) {
+  // run `dtable` 16 characters at a time with the state in a vector register,
+  // every lane holding its row index. each step is then one `pshufb` of the
+  // row of the column of the next character, with no load depending on the
+  // state. rows are per input character rather than per column, and input
+  // is read 8 characters at a time, so each step costs a single load. stops
+  // before any group of 8 characters that ends below `stop`, leaving it for
+  // the regular loop to redo precisely. updates `*state` and returns where it
+  // stopped
+  uint8_t *shuffles = dtable_shuffles(dtable);
+  __m128i state_v = _mm_set1_epi8((uint32_t)*state / dtable->stride);
+  for (; end - p >= 8; p += 8) {
+    __m128i next = state_v;
+    uint64_t chars;
+    memcpy(&chars, p, 8); // x86 is little-endian
+    for (int i = 0; i < 8; i++, chars >>= 8)
+      next = _mm_shuffle_epi8(
+          _mm_loadu_si128((__m128i *)(shuffles + (chars & 0xff) * 16)), next);
+    if ((uint8_t)_mm_cvtsi128_si32(next) * dtable->stride < dtable->stop)
+      break;
+    state_v = next;
+  }
+  *state = (uint8_t)_mm_cvtsi128_si32(state_v) * dtable->stride;
+  return p;
+}
+#endif
+
+uint8_t *dtable_run(struct dtable *dtable, uint32_t *id, uint8_t *begin,
+                   uint8_t *end, int eol) {
+  // run `dtable` from state `*id` on the input `begin..end`, stopping before
+  // the first occurrence of `eol` or upon reaching a terminating state. pass
+  // `eol = EOF` to never stop early on input characters. returns where the
+  // run stopped and stores the state reached into `*id`. the loop is
+  // specialized on `width` so that each input character costs one lookup into
+  // `map` and one into `table`, and no pointer chasing. it only leaves the
+  // fast loop below `stop`, where accelerated states skip over their self-
+  // loops with `dtable_skip` then step on the exit character they landed on.
+  // with a stride-2 table, the fast loop first takes two characters per
+  // lookup, halving the dependent loads. it leaves the pair loop before any
+  // pair landing below `stop` and lets the single loop take the pair again,
+  // so it stops at the exact same place. the state in between may be below
+  // `stop` too, but terminating states only lead to terminating states, so it
+  // is accelerated, which makes skipping over it harmless. tables with a
+  // shuffle table go through `dtable_shuffle` before all that, if the CPU
+  // supports it. only without `eol` though: lines tend to be too short to
+  // make up for entering and leaving the kernel
+  uint8_t *map = dtable->map, *p = begin;
+  uint8_t *records =
+      dtable->table + (size_t)dtable->size * dtable->stride * dtable->width;
+  uint16_t *pairs = dtable->pairs ? dtable_pairs(dtable) : NULL;
+  size_t state = *id, stop = dtable->stop; // no zero-extension
+  size_t stride = dtable->stride, pstop = stop * stride;
+#ifdef X86_TARGET
+  bool shuffle = dtable->shuffles && eol == EOF && dtable_can_shuffle();
+#define DTABLE_SHUFFLE                                                         \
+  if (shuffle && state >= stop)                                                \
+    p = dtable_shuffle(dtable, &state, p, end);
+#else
+#define DTABLE_SHUFFLE
+#endif
+#define DTABLE_RUN(TYPE)                                                       \
+  for (TYPE *table = (TYPE *)dtable->table;;                                   \
+       state = table[state + map[*p++]]) {                                     \
+    DTABLE_SHUFFLE                                                             \
+    if (pairs && state >= stop) {                                              \
+      size_t pstate = state * stride, next;                                    \
+      while (end - p >= 2 && p[0] != eol && p[1] != eol &&                     \
+             (next = pairs[pstate + map[p[0]] * stride + map[p[1]]]) >= pstop) \
+        pstate = next, p += 2;                                                 \
+      state = (uint32_t)pstate / (uint32_t)stride;                             \
+    }                                                                          \
+    while (p < end && *p != eol && state >= stop)                              \
+      state = table[state + map[*p++]];                                        \
+    if (p == end || *p == eol || dtable_terminating(dtable, state))            \
+      break;                                                                   \
+    p = dtable_skip(records + state / dtable->stride * 4, p, end, eol);        \
+    if (p == end || *p == eol)                                                 \
+      break;                                                                   \
+  }
+  switch (dtable->width) {
+  case 1:
+    DTABLE_RUN(uint8_t);
+    break;
+  case 2:
+    DTABLE_RUN(uint16_t);
+    break;
+  default:
+    DTABLE_RUN(uint32_t);
+    break;
+  }
+#undef DTABLE_RUN
+#undef DTABLE_SHUFFLE
+  return *id = state, p;
+}
+
+#ifdef __unix__
+// speculative parallel matching, after Mytkowicz et al., "Data-Parallel
+// Finite-State Machines". the input is cut into one chunk per thread. the
+// first chunk runs from the state we were given, but the state every other
+// chunk starts in depends on all the chunks before it. so those run from all
+// states at once, one run per state, and the calling thread chains the chunks
+// together afterwards, with one lookup per chunk. that looks like `size` times
+// the work, but runs from distinct states tend to reach the same state within
+// a few characters, after which they can be merged. once a single run is left
+// standing, the chunk goes through `dtable_run` like any other. a chunk with
+// as many runs as there are threads left after a while can't win anything
+// over a sequential scan though, and neither can one whose runs take too long
+// to merge. such chunks are given up on and left for the calling thread to
+// run once it knows which state they start in
+#define DSPEC_CHUNK_MIN (1 << 20) // bytes per thread, to amortize the set-up
+#define DSPEC_STATES_MAX (1 << 16) // larger tables aren't worth speculating on
+#define DSPEC_RUNS_MAX 16 // runs that can be stepped in lockstep
+#define DSPEC_WARMUP 4096 // bytes to give runs to merge before judging them
+// lookups to spend on lockstep, about as much as `DSPEC_RUNS_MAX` runs take
+// over `DSPEC_WARMUP` bytes. large tables that don't converge get only a few
+// characters' worth, rather than a lookup per state per byte of warm-up
+#define DSPEC_LOCKSTEP_MAX (DSPEC_WARMUP * DSPEC_RUNS_MAX)
+#define DSPEC_BLOCK 4096 // bytes between merges, once there are few runs
+
+struct dspec {
+  struct dtable *dtable;
+  int threads;
+  pthread_mutex_t lock; // guards `cancel`
+  bool cancel; // when the first chunk ends in a terminating state
+  struct dchunk {
+    struct dspec *dspec;
+    uint8_t *begin, *end;
+    bool failed;      // whether the chunk was given up on
+    uint32_t *states; // where the run from each row stands
+    uint32_t *merged; // run that each run merged into, or itself
+  } chunks[];
+};
+
+static bool dspec_cancelled(struct dspec *dspec) {
+  pthread_mutex_lock(&dspec->lock);
+  bool cancel = dspec->cancel;
+  pthread_mutex_unlock(&dspec->lock);
+  return cancel;
+}
+
+static void *dspec_work(void *arg) {
+  // runs are numbered after the row they start from. only the runs in
+  // `active` are still stepped: the others have either merged into another
+  // run or reached a terminating state, where `dtable_run` would have stopped
+  struct dchunk *chunk = arg;
+  struct dtable *dtable = chunk->dspec->dtable;
+  uint32_t size = dtable->size, stride = dtable->stride, nactive = 0;
+  uint32_t *active = malloc(sizeof *active * size);
+  uint32_t *owner = malloc(sizeof *owner * size); // run standing in each row
+  size_t *stamp = calloc(size, sizeof *stamp); // merge `owner` was set during
+  for (uint32_t run = 0; run < size; run++) {
+    chunk->states[run] = run * stride, chunk->merged[run] = run;
+    if (!dtable_terminating(dtable, run * stride))
+      active[nactive++] = run;
+  }
+
+  // while there are many runs, step them all in lockstep and merge after every
+  // character. the loop over runs is innermost so that their lookups don't
+  // depend on one another. once there are few, let each go through
+  // `dtable_run` for a block at a time, and check back in between in case the
+  // result is no longer needed
+  uint8_t *p = chunk->begin, *end = chunk->end;
+  size_t lookups = 0; // spent on lockstep
+  for (size_t merge = 1; nactive && p < end; merge++) {
+    bool many = nactive > DSPEC_RUNS_MAX;
+    if (many ? (lookups += nactive) > DSPEC_LOCKSTEP_MAX
+             : p - chunk->begin >= DSPEC_WARMUP &&
+                       nactive >= chunk->dspec->threads ||
+                   dspec_cancelled(chunk->dspec)) {
+      chunk->failed = true;
+      break;
+    }
+    size_t block = many ? 1 : nactive > 1 ? DSPEC_BLOCK : DSPEC_CHUNK_MIN;
+    uint8_t *next = end - p > block ? p + block : end;
+    for (; many && p < next; p++)
+      for (uint32_t i = 0; i < nactive; i++)
+        chunk->states[active[i]] =
+            dtable_step(dtable, chunk->states[active[i]], *p);
+    for (uint32_t i = 0; !many && i < nactive; i++)
+      dtable_run(dtable, &chunk->states[active[i]], p, next, EOF);
+    p = next;
+
+    // runs that stopped early are in terminating states, so comparing them
+    // against runs that didn't is harmless
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < nactive; i++) {
+      uint32_t run = active[i], row = chunk->states[run] / stride;
+      if (stamp[row] == merge)
+        chunk->merged[run] = owner[row];
+      else if (stamp[row] = merge, owner[row] = run,
+               !dtable_terminating(dtable, chunk->states[run]))
+        active[kept++] = run;
+    }
+    nactive = kept;
+  }
+  free(active), free(owner), free(stamp);
+  return NULL;
+}
+
+uint32_t dtable_run_parallel(struct dtable *dtable, uint32_t id, uint8_t *begin,
+                             uint8_t *end, int threads) {
+  // like `dtable_run` with `eol = EOF`, but across up to `threads` threads, the
+  // calling thread included. returns the state reached, which is that where
+  // `dtable_run` would have stopped. the position it would have stopped at is
+  // lost, as finding it would take going over the chunk again
+  size_t len = end - begin;
+  if (threads > 1 && (size_t)threads > len / DSPEC_CHUNK_MIN)
+    threads = len / DSPEC_CHUNK_MIN;
+  if (threads <= 1 || dtable->size > DSPEC_STATES_MAX)
+    return dtable_run(dtable, &id, begin, end, EOF), id;
+
+  struct dspec *dspec =
+      calloc(1, sizeof *dspec + threads * sizeof *dspec->chunks);
+  dspec->dtable = dtable, dspec->threads = threads;
+  pthread_mutex_init(&dspec->lock, NULL);
+  for (int i = 0; i < threads; i++) {
+    struct dchunk *chunk = &dspec->chunks[i];
+    chunk->dspec = dspec;
+    chunk->begin = begin + len * i / threads;
+    chunk->end = begin + len * (i + 1) / threads;
+  }
+
+  // chunks that couldn't be given a thread are run sequentially below
+  pthread_t tids[threads];
+  bool started[threads];
+  for (int i = 1; i < threads; i++) {
+    struct dchunk *chunk = &dspec->chunks[i];
+    chunk->states = malloc(sizeof *chunk->states * dtable->size);
+    chunk->merged = malloc(sizeof *chunk->merged * dtable->size);
+    if (!(started[i] = !pthread_create(&tids[i], NULL, dspec_work, chunk)))
+      chunk->failed = true;
+  }
+  dtable_run(dtable, &id, dspec->chunks->begin, dspec->chunks->end, EOF);
+  if (dtable_terminating(dtable, id)) {
+    pthread_mutex_lock(&dspec->lock);
+    dspec->cancel = true;
+    pthread_mutex_unlock(&dspec->lock);
+  }
+  for (int i = 1; i < threads; i++)
+    if (started[i])
+      pthread_join(tids[i], NULL);
+
+  for (int i = 1; i < threads && !dtable_terminating(dtable, id); i++) {
+    struct dchunk *chunk = &dspec->chunks[i];
+    if (chunk->failed) {
+      dtable_run(dtable, &id, chunk->begin, chunk->end, EOF);
+      continue;
+    }
+    uint32_t run = id / dtable->stride;
+    while (chunk->merged[run] != run)
+      run = chunk->merged[run];
+    id = chunk->states[run];
+  }
+
+  for (int i = 1; i < threads; i++)
+    free(dspec->chunks[i].states), free(dspec->chunks[i].merged);
+  pthread_mutex_destroy(&dspec->lock), free(dspec);
+  return id;
+}
+#else
+uint32_t dtable_run_parallel(struct dtable *dtable, uint32_t id, uint8_t *begin,
+                             uint8_t *end, int threads) {
+  return dtable_run(dtable, &id, begin, end, EOF), id; // no threads to speak of
+}
+#endif
+
+// some invariants for parsers on parse error:
+//   - `error` shall be set to a non-`NULL` error message
+//   - `regex` shall point to the error location
+//   - the returned regular expression should be `NULL`
+//   - the caller is responsible for backtracking
+
+// keep in sync with grammar.bnf and ltre.vim
+
+static int parse_ws(char **pattern) {
+  while (isspace(**pattern))
+    ++*pattern;
+  return 1; // for use within &&
 }
 
 static unsigned parse_natural(char **pattern, char **error) {
@@ -1506,68 +2977,100 @@ next_quant:
                       : regex_repeat(atom, lower, upper);
 }
 
+static struct regex **parse_push(struct regex *regexes[], size_t *len,
+                                 size_t *cap, struct regex *regex) {
+  // append `regex` to the growable array `regexes`, keeping it terminated
+  if (*len + 1 >= *cap)
+    *cap = *cap ? *cap * 2 : 16,
+    regexes = realloc(regexes, *cap * sizeof *regexes);
+  return regexes[(*len)++] = regex, regexes[*len] = NULL, regexes;
+}
+
+static void parse_free(struct regex *regexes[]) {
+  // free a growable array along with the regexes it owns. may be `NULL`
+  if (regexes)
+    free(regexes_decref(regexes));
+}
+
 static struct regex *parse_term(char **pattern, char **error) {
-  struct regex *factors = regex_eps();
+  // factors are collected then concatenated at once, as `regex_concat` copies
+  // its children. long literals would otherwise take quadratic time
+  struct regex **factors = NULL;
+  size_t len = 0, cap = 0;
 
   // hacky lookahead for better diagnostics
   while (parse_ws(pattern), !strchr(":|&=)", **pattern)) {
     struct regex *cat = parse_factor(pattern, error);
     if (*error)
-      return regex_decref(factors), NULL;
+      return parse_free(factors), NULL;
 
-    factors = regex_concat(REGEXES(factors, cat));
+    factors = parse_push(factors, &len, &cap, cat);
   }
 
+  struct regex *term = regex_concat(factors ? factors : REGEXES(NULL));
+  free(factors);
+
   if (**pattern == ':' && ++*pattern && parse_ws(pattern)) {
     struct regex *dcat = parse_term(pattern, error);
     if (*error)
-      return regex_decref(factors), NULL;
+      return regex_decref(term), NULL;
 
     return regex_compl(
-        regex_concat(REGEXES(regex_compl(factors), regex_compl(dcat))));
+        regex_concat(REGEXES(regex_compl(term), regex_compl(dcat))));
   }
 
-  return factors;
+  return term;
 }
 
 static struct regex *parse_regex(char **pattern, char **error) {
-  bool compl = **pattern == '!' && ++*pattern && parse_ws(pattern);
+  // alternatives are parsed in a loop rather than by right recursion, then
+  // handed to `regex_alt` all at once. generated patterns can have hundreds of
+  // thousands of them, which would otherwise overflow the stack and take
+  // quadratic time
+  struct regex **alts = NULL;
+  size_t len = 0, cap = 0;
 
-  struct regex *term = parse_term(pattern, error);
-  if (*error)
-    return NULL;
+  while (1) {
+    bool compl = **pattern == '!' && ++*pattern && parse_ws(pattern);
 
-  if (**pattern == '=' && ++*pattern && parse_ws(pattern)) {
-    struct regex *bicond = parse_regex(pattern, error);
+    struct regex *term = parse_term(pattern, error);
     if (*error)
-      return regex_decref(term), NULL;
+      return parse_free(alts), NULL;
 
-    regex_incref(term), regex_incref(bicond);
-    struct regex *neither = regex_compl(
-        regex_alt(REGEXES(compl ? regex_compl(term) : term, bicond)));
-    struct regex *both = regex_compl(regex_alt(
-        REGEXES(compl ? term : regex_compl(term), regex_compl(bicond))));
-    return regex_alt(REGEXES(neither, both));
-  }
+    if (**pattern == '=' && ++*pattern && parse_ws(pattern)) {
+      struct regex *bicond = parse_regex(pattern, error);
+      if (*error)
+        return regex_decref(term), parse_free(alts), NULL;
+
+      regex_incref(term), regex_incref(bicond);
+      struct regex *neither = regex_compl(
+          regex_alt(REGEXES(compl ? regex_compl(term) : term, bicond)));
+      struct regex *both = regex_compl(regex_alt(
+          REGEXES(compl ? term : regex_compl(term), regex_compl(bicond))));
+      term = regex_alt(REGEXES(neither, both)), compl = false;
+    }
 
-  if (**pattern == '|' && ++*pattern && parse_ws(pattern)) {
-    struct regex *alt = parse_regex(pattern, error);
-    if (*error)
-      return regex_decref(term), NULL;
+    else if (**pattern == '&' && ++*pattern && parse_ws(pattern)) {
+      struct regex *int_ = parse_regex(pattern, error);
+      if (*error)
+        return regex_decref(term), parse_free(alts), NULL;
 
-    return regex_alt(REGEXES(compl ? regex_compl(term) : term, alt));
-  }
+      term = regex_compl(regex_alt(
+          REGEXES(compl ? term : regex_compl(term), regex_compl(int_))));
+      compl = false;
+    }
 
-  if (**pattern == '&' && ++*pattern && parse_ws(pattern)) {
-    struct regex *int_ = parse_regex(pattern, error);
-    if (*error)
-      return regex_decref(term), NULL;
+    term = compl ? regex_compl(term) : term;
+    if (!alts && **pattern != '|')
+      return term; // no alternation; skip the allocation
+    alts = parse_push(alts, &len, &cap, term);
 
-    return regex_compl(regex_alt(
-        REGEXES(compl ? term : regex_compl(term), regex_compl(int_))));
+    if (!(**pattern == '|' && ++*pattern && parse_ws(pattern)))
+      break;
   }
 
-  return compl ? regex_compl(term) : term;
+  struct regex *alt = regex_alt(alts);
+  return free(alts), alt;
 }
 
 struct regex *ltre_parse(char **pattern, char **error) {
@@ -1601,7 +3104,7 @@ struct regex *ltre_fixed_string(char *string) {
 
   symset_t symset = {0};
   struct regex *children[strlen(string) + 1], **child = children;
-  for (char *p = string; *p; symset_write(symset, *p++, false))
+  for (uint8_t *p = (uint8_t *)string; *p; symset_write(symset, *p++, false))
     symset_write(symset, *p, true), *child++ = regex_symset(&symset);
   *child = NULL;
 
@@ -1618,33 +3121,473 @@ char *ltre_stringify(struct regex *regex) {
   return regex_decref(regex), pattern;
 }
 
-static void dfa_step(struct dstate **dfap, struct dstate *dstate, uint8_t chr) {
-  // give state `dstate` an outbound transition on `chr` to some state of the
-  // partial DFA `*dfap`, marching the regex in lock stop, and creating a new
-  // state if an adequate one doesn't already exist
+// literals that every word matched by a regex must start with, end with, and
+// contain, for prefiltering; see `ltre_required`. when `exact`, the regex
+// matches `pre` and nothing else. literals are capped at `LITS_MAX` bytes,
+// which keeps the head of prefixes and the tail of suffixes. all zeros means
+// we know nothing, which is always a sound answer
+#define LITS_MAX 64
+struct lits {
+  bool exact;
+  int pre_len, suf_len, fac_len;
+  uint8_t pre[LITS_MAX], suf[LITS_MAX], fac[LITS_MAX];
+};
 
-  if (dstate->transitions[chr])
-    return;
+static bool lits_append(uint8_t *dst, int *dst_len, uint8_t *src, int src_len,
+                        bool tail) {
+  // append `src` to `dst`, keeping either the head or the tail of the result
+  // if it doesn't fit. returns whether anything was cut off
+  int excess = *dst_len + src_len - LITS_MAX;
+  if (excess <= 0)
+    return memcpy(dst + *dst_len, src, src_len), *dst_len += src_len, false;
+  if (!tail)
+    return memcpy(dst + *dst_len, src, src_len - excess), *dst_len = LITS_MAX,
+           true;
+  if (excess < *dst_len)
+    memmove(dst, dst + excess, *dst_len - excess);
+  int keep = src_len < LITS_MAX ? src_len : LITS_MAX;
+  memcpy(dst + LITS_MAX - keep, src + src_len - keep, keep);
+  return *dst_len = LITS_MAX, true;
+}
+
+static void lits_factor(struct lits *lits, uint8_t *factor, int len) {
+  // longer factors make for fewer false positives
+  if (len > lits->fac_len)
+    memcpy(lits->fac, factor, len), lits->fac_len = len;
+}
+
+// sets of literals such that every word matched by a regex contains one of
+// them, for `prefilter_alloc`. an empty set means we know nothing
+#define FACTORS_MAX 64
+struct factor {
+  int len;
+  uint8_t bytes[LITS_MAX];
+};
+struct factors {
+  int len;
+  struct factor items[FACTORS_MAX];
+};
+
+static int factors_score(struct factors *factors) {
+  // candidates get rarer as the shortest literal grows, up to about as many
+  // bytes as `prefilter_find` fingerprints, and as there are fewer literals
+  int min = LITS_MAX;
+  for (int i = 0; i < factors->len; i++)
+    min = factors->items[i].len < min ? factors->items[i].len : min;
+  return factors->len ? (min < 4 ? min : 4) * 256 - factors->len : 0;
+}
+
+static void factors_keep(struct factors *best, struct factors *factors) {
+  // keep whichever set is better, the earlier one on ties. `best` may be `NULL`
+  if (best && factors_score(factors) > factors_score(best))
+    memcpy(best, factors, sizeof(*factors));
+}
+
+static void regex_lits(struct regex *regex, struct lits *lits,
+                       struct factors *factors) {
+  // a conservative analysis: every literal it reports is sound, but it
+  // sometimes misses some. if `factors` is non-`NULL`, also gather a set of
+  // literals into it. alternatives needn't agree on those: instead, their sets
+  // are joined. each set is no worse than the required literal. both come out
+  // of the same pass, so that every node is visited once. borrows its argument
+  *lits = (struct lits){0};
+  struct lits sub;
+  struct factors *subf = NULL, *best = NULL, *alt = NULL;
+  if (factors)
+    subf = malloc(sizeof(*subf)), best = malloc(sizeof(*best)), best->len = 0;
+
+  switch (regex->type) {
+  case TYPE_SYMSET:;
+    int chr = -1, count = 0;
+    for (int c = 0; c < 256 && count < 2; c++)
+      if (symset_read(regex->symset, c))
+        chr = c, count++;
+    if (count == 1)
+      *lits = (struct lits){true, 1, 1, 1, {chr}, {chr}, {chr}};
+    break;
+
+  case TYPE_CONCAT:;
+    // `suf` doubles as the literal that ends at the current child. exact
+    // children extend it, and other children contribute their prefix to it
+    // before it restarts at their suffix
+    bool open = true, cut = false; // all children so far are exact
+    // every word contains a word of each child
+    lits->exact = true;
+    for (struct regex **child = regex->children; *child; child++) {
+      regex_lits(*child, &sub, subf), factors_keep(best, subf);
+      if (sub.exact) {
+        lits_append(lits->suf, &lits->suf_len, sub.pre, sub.pre_len, true);
+        if (open)
+          cut |= lits_append(lits->pre, &lits->pre_len, sub.pre, sub.pre_len,
+                             false);
+        continue;
+      }
+      lits_append(lits->suf, &lits->suf_len, sub.pre, sub.pre_len, true);
+      lits_factor(lits, lits->suf, lits->suf_len);
+      lits_factor(lits, sub.fac, sub.fac_len);
+      if (open)
+        lits_append(lits->pre, &lits->pre_len, sub.pre, sub.pre_len, false);
+      memcpy(lits->suf, sub.suf, sub.suf_len), lits->suf_len = sub.suf_len;
+      open = false;
+    }
+    lits->exact = open && !cut;
+    lits_factor(lits, lits->suf, lits->suf_len);
+    break;
+
+  case TYPE_ALT:;
+    // every alternative must agree. `[]` matches nothing so anything would do,
+    // but it gets no special treatment. for sets, every alternative must
+    // contribute, and `[]` contributes nothing
+    if (factors)
+      alt = malloc(sizeof(*alt)), alt->len = 0;
+    for (struct regex **child = regex->children; *child; child++) {
+      regex_lits(*child, &sub, subf);
+      if (alt && (!subf->len || alt->len + subf->len > FACTORS_MAX))
+        free(alt), alt = NULL;
+      else if (alt) {
+        memcpy(alt->items + alt->len, subf->items,
+               subf->len * sizeof(*subf->items));
+        alt->len += subf->len;
+      }
+      if (child == regex->children) {
+        *lits = sub;
+        continue;
+      }
+      int pre = 0, suf = 0;
+      while (pre < lits->pre_len && pre < sub.pre_len &&
+             lits->pre[pre] == sub.pre[pre])
+        pre++;
+      uint8_t *end1 = lits->suf + lits->suf_len, *end2 = sub.suf + sub.suf_len;
+      while (suf < lits->suf_len && suf < sub.suf_len &&
+             end1[-1 - suf] == end2[-1 - suf])
+        suf++;
+      memmove(lits->suf, lits->suf + lits->suf_len - suf, suf);
+      bool same = lits->fac_len == sub.fac_len &&
+                  memcmp(lits->fac, sub.fac, sub.fac_len) == 0;
+      lits->exact &= sub.exact && same && pre == lits->pre_len;
+      lits->pre_len = pre, lits->suf_len = suf;
+      lits->fac_len = same ? lits->fac_len : 0;
+    }
+    lits_factor(lits, lits->pre, lits->pre_len);
+    lits_factor(lits, lits->suf, lits->suf_len);
+    if (alt)
+      factors_keep(best, alt);
+    break;
+
+  case TYPE_REPEAT:
+    if (regex->lower == 0)
+      break; // might match the empty word
+    regex_lits(*regex->children, &sub, subf), factors_keep(best, subf);
+    if (!sub.exact) {
+      *lits = sub;
+      break;
+    }
+    // every word starts and ends with `lower` copies of the child. once both
+    // literals are full, more copies would change nothing
+    bool cut_pre = false, cut_suf = false;
+    for (unsigned i = 0; i < regex->lower && !(cut_pre && cut_suf); i++) {
+      cut_pre |=
+          lits_append(lits->pre, &lits->pre_len, sub.pre, sub.pre_len, false);
+      cut_suf |=
+          lits_append(lits->suf, &lits->suf_len, sub.pre, sub.pre_len, true);
+    }
+    lits->exact = regex->lower == regex->upper && !cut_pre;
+    lits_factor(lits, lits->pre, lits->pre_len);
+    lits_factor(lits, lits->suf, lits->suf_len);
+    break;
+
+  case TYPE_COMPL:
+    // `a & b` comes out as `!(!a | !b)`, and every word it matches is matched
+    // by `a`, so the literals of any conjunct hold for the whole. we give up
+    // on other complements
+    if ((*regex->children)->type != TYPE_ALT)
+      break;
+    for (struct regex **child = (*regex->children)->children; *child; child++) {
+      if ((*child)->type != TYPE_COMPL)
+        continue;
+      regex_lits(*(*child)->children, &sub, subf), factors_keep(best, subf);
+      if (sub.pre_len > lits->pre_len)
+        memcpy(lits->pre, sub.pre, sub.pre_len), lits->pre_len = sub.pre_len;
+      if (sub.suf_len > lits->suf_len)
+        memcpy(lits->suf, sub.suf, sub.suf_len), lits->suf_len = sub.suf_len;
+      lits_factor(lits, sub.fac, sub.fac_len);
+    }
+    break;
+  }
+
+  // the required literal seeds the set, and the best set of a child, if any,
+  // replaces it
+  if (factors) {
+    factors->len = 0;
+    if (lits->fac_len)
+      factors->len = 1, factors->items->len = lits->fac_len,
+      memcpy(factors->items->bytes, lits->fac, lits->fac_len);
+    factors_keep(factors, best);
+  }
+  free(subf), free(best), free(alt);
+}
+
+uint8_t *ltre_required(struct regex *regex, size_t *len) {
+  // a literal that every word matched by `regex` contains, for prefiltering
+  // with `ltre_search`. `*len` is set to its length, which is zero when no
+  // such literal was found. complements other than intersections are given up
+  // on, so complemented patterns get nothing. borrows `regex`. returns a new
+  // allocation
+  struct lits lits;
+  regex_lits(regex, &lits, NULL);
+  uint8_t *literal = malloc(lits.fac_len + 1);
+  memcpy(literal, lits.fac, lits.fac_len), *len = lits.fac_len;
+  return literal;
+}
+
+static int search_rank(uint8_t chr) {
+  // rough rank of how common `chr` is in text, for `ltre_search`
+  return chr == ' ' || islower(chr) ? 3 : isdigit(chr) || isspace(chr) ? 2
+         : isprint(chr)                                                ? 1
+                                                                       : 0;
+}
+
+uint8_t *ltre_search(uint8_t *begin, uint8_t *end, uint8_t *literal,
+                     size_t len) {
+  // find the first occurrence of `literal` within `begin..end`, or return
+  // `NULL`. we `memchr` for the byte of `literal` that looks the rarest then
+  // compare the rest, so that candidates come few and far between
+  if ((size_t)(end - begin) < len)
+    return NULL;
+  if (len == 0)
+    return begin;
+  size_t rare = 0;
+  for (size_t i = 1; i < len; i++)
+    if (search_rank(literal[i]) < search_rank(literal[rare]))
+      rare = i;
+
+  // candidates for the rare byte lie within `begin + rare..last`
+  uint8_t *p = begin + rare, *last = end - len + rare + 1;
+  while ((p = memchr(p, literal[rare], last - p))) {
+    if (memcmp(p - rare, literal, len) == 0)
+      return p - rare;
+    if (++p == last)
+      break;
+  }
+  return NULL;
+}
+
+static int factors_order(const void *a, const void *b) {
+  const struct factor *fa = a, *fb = b;
+  int cmp = memcmp(fa->bytes, fb->bytes, fa->len < fb->len ? fa->len : fb->len);
+  return cmp ? cmp : fa->len - fb->len;
+}
+
+// packed search for any of a set of literals, after the Teddy algorithm of
+// Hyperscan. literals are sorted then spread over eight buckets, and for each
+// of the first `width` bytes of a literal, two 16-entry tables map the low and
+// the high nibble of an input byte to the buckets with a literal whose byte
+// there has that nibble. `pshufb` looks up 16 or 32 input bytes at once, and
+// ANDing the lookups at consecutive offsets gives the buckets that might have
+// a literal starting at each position, which then get verified. the scalar
+// fallback looks up whole bytes instead
+struct prefilter {
+  int len, width, simd; // `simd` is 0 for none, 1 for SSSE3, 2 for AVX2
+  int first[9]; // literals of bucket `b` are `items[first[b]..first[b + 1]]`
+  uint8_t masks[3][256];
+  uint8_t nibbles[3][2][16];
+  struct factor items[FACTORS_MAX];
+};
+
+struct prefilter *prefilter_alloc(struct regex *regex) {
+  // returns `NULL` if there is no set of literals worth searching for. borrows
+  // `regex`
+  struct factors *factors = malloc(sizeof(*factors));
+  struct lits lits;
+  regex_lits(regex, &lits, factors);
+  if (!factors->len)
+    return free(factors), NULL;
+
+  struct prefilter *filter = calloc(1, sizeof(*filter));
+  qsort(factors->items, factors->len, sizeof(*factors->items), factors_order);
+  filter->width = 3;
+  for (int i = 0; i < factors->len; i++) {
+    struct factor *item = factors->items + i;
+    struct factor *last = filter->items + filter->len - 1;
+    if (filter->len && factors_order(item, last) == 0)
+      continue; // duplicate
+    filter->items[filter->len++] = *item;
+    filter->width = item->len < filter->width ? item->len : filter->width;
+  }
+  free(factors);
+
+  // neighboring literals share prefixes, so sharing buckets costs them little
+  for (int b = 0; b <= 8; b++)
+    filter->first[b] = b * filter->len / 8;
+  for (int b = 0; b < 8; b++)
+    for (int i = filter->first[b]; i < filter->first[b + 1]; i++)
+      for (int k = 0; k < filter->width; k++) {
+        uint8_t chr = filter->items[i].bytes[k];
+        filter->masks[k][chr] |= 1 << b;
+        filter->nibbles[k][0][chr & 0x0f] |= 1 << b;
+        filter->nibbles[k][1][chr >> 4] |= 1 << b;
+      }
+
+#ifdef X86_TARGET
+  filter->simd = __builtin_cpu_supports("avx2")    ? 2
+                 : __builtin_cpu_supports("ssse3") ? 1
+                                                   : 0;
+#endif
+  return filter;
+}
+
+void prefilter_free(struct prefilter *filter) { free(filter); }
+
+static uint8_t *prefilter_verify(struct prefilter *filter, uint8_t *p,
+                                 uint8_t *end, unsigned buckets) {
+  for (int b = 0; b < 8; b++)
+    for (int i = filter->first[b]; buckets >> b & 1 && i < filter->first[b + 1];
+         i++) {
+      struct factor *item = filter->items + i;
+      if (item->len <= end - p && memcmp(p, item->bytes, item->len) == 0)
+        return p;
+    }
+  return NULL;
+}
+
+#ifdef X86_TARGET
+// the block loops return the first hit, or `NULL` with `*p` advanced past the
+// blocks searched, leaving the rest to the scalar loop
+X86_TARGET("ssse3")
+static uint8_t *prefilter_ssse3(struct prefilter *filter, uint8_t **p,
+                                uint8_t *end) {
+  __m128i lo[3], hi[3], nibble = _mm_set1_epi8(0x0f);
+  for (int k = 0; k < filter->width; k++)
+    lo[k] = _mm_loadu_si128((__m128i *)filter->nibbles[k][0]),
+    hi[k] = _mm_loadu_si128((__m128i *)filter->nibbles[k][1]);
+
+  for (; end - *p >= 16 + filter->width - 1; *p += 16) {
+    __m128i buckets = _mm_set1_epi8(-1);
+    for (int k = 0; k < filter->width; k++) {
+      __m128i v = _mm_loadu_si128((__m128i *)(*p + k));
+      __m128i vlo = _mm_and_si128(v, nibble);
+      __m128i vhi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+      buckets = _mm_and_si128(buckets,
+                              _mm_and_si128(_mm_shuffle_epi8(lo[k], vlo),
+                                            _mm_shuffle_epi8(hi[k], vhi)));
+    }
+    unsigned mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(buckets, _mm_setzero_si128())) ^ 0xffff;
+    if (!mask)
+      continue;
+    uint8_t lanes[16], *hit;
+    _mm_storeu_si128((__m128i *)lanes, buckets);
+    for (; mask; mask &= mask - 1) {
+      int i = __builtin_ctz(mask);
+      if ((hit = prefilter_verify(filter, *p + i, end, lanes[i])))
+        return hit;
+    }
+  }
+  return NULL;
+}
+
+X86_TARGET("avx2")
+static uint8_t *prefilter_avx2(struct prefilter *filter, uint8_t **p,
+                               uint8_t *end) {
+  __m256i lo[3], hi[3], nibble = _mm256_set1_epi8(0x0f);
+  for (int k = 0; k < filter->width; k++)
+    lo[k] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)filter->nibbles[k][0])),
+    hi[k] = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)filter->nibbles[k][1]));
+
+  for (; end - *p >= 32 + filter->width - 1; *p += 32) {
+    __m256i buckets = _mm256_set1_epi8(-1);
+    for (int k = 0; k < filter->width; k++) {
+      __m256i v = _mm256_loadu_si256((__m256i *)(*p + k));
+      __m256i vlo = _mm256_and_si256(v, nibble);
+      __m256i vhi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+      buckets = _mm256_and_si256(
+          buckets, _mm256_and_si256(_mm256_shuffle_epi8(lo[k], vlo),
+                                    _mm256_shuffle_epi8(hi[k], vhi)));
+    }
+    unsigned mask = ~(unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(buckets, _mm256_setzero_si256()));
+    if (!mask)
+      continue;
+    uint8_t lanes[32], *hit;
+    _mm256_storeu_si256((__m256i *)lanes, buckets);
+    for (; mask; mask &= mask - 1) {
+      int i = __builtin_ctz(mask);
+      if ((hit = prefilter_verify(filter, *p + i, end, lanes[i])))
+        return hit;
+    }
+  }
+  return NULL;
+}
+#endif
+
+uint8_t *prefilter_find(struct prefilter *filter, uint8_t *begin,
+                        uint8_t *end) {
+  // find the first occurrence of any literal of `filter` within `begin..end`,
+  // or return `NULL`. a lone literal is best left to `ltre_search`
+  if (filter->len == 1)
+    return ltre_search(begin, end, filter->items->bytes, filter->items->len);
+
+  uint8_t *p = begin, *hit = NULL;
+#ifdef X86_TARGET
+  if (filter->simd == 2)
+    hit = prefilter_avx2(filter, &p, end);
+  if (filter->simd == 1)
+    hit = prefilter_ssse3(filter, &p, end);
+  if (hit)
+    return hit;
+#endif
+
+  for (; p < end; p++) {
+    unsigned buckets = filter->masks[0][*p];
+    for (int k = 1; k < filter->width && buckets; k++)
+      buckets &= p + k < end ? filter->masks[k][p[k]] : 0;
+    if (buckets && (hit = prefilter_verify(filter, p, end, buckets)))
+      return hit;
+  }
+  return NULL;
+}
+
+static struct dstate *dfa_target(struct dstate *dfa, struct dstate *dstate,
+                                 uint8_t chr) {
+  // find the state of the partial DFA `dfa` that `dstate` should transition to
+  // on `chr`, marching the regex in lock step, and creating a new state if an
+  // adequate one doesn't already exist
 
   struct regex *delta = regex_differentiate_ref(dstate->regex, chr);
 
-  // binary tree not necessary, linear search is just as fast
-  struct dstate **dstatep = dfap;
-  while (*dstatep && regex_cmp((*dstatep)->regex, delta) != 0)
-    dstatep = &(*dstatep)->next;
+  // index the states of the partial DFA on first use
+  struct dindex **index = &dfa->index;
+  if (!*index)
+    for (struct dstate *ds = dfa; ds; ds = ds->next)
+      *index = dindex_insert(*index, ds), (*index)->tail = ds;
+
+  struct dstate *target = dindex_find(*index, delta);
+  if (target)
+    return regex_decref(delta), target;
+  target = dstate_new(delta, dfa->classes);
+  (*index)->tail = (*index)->tail->next = target;
+  *index = dindex_insert(*index, target);
+  return target;
+}
 
-  if (*dstatep)
-    delta = regex_decref(delta);
-  else
-    *dstatep = dstate_alloc(delta);
+static void dfa_step(struct dstate **dfap, struct dstate *dstate, uint8_t chr) {
+  // give state `dstate` an outbound transition on `chr` to some state of the
+  // partial DFA `*dfap`; see `dfa_target`
 
-  // `regex_differentiate` computes a derivative along with a conservative
-  // set of characters for which it holds. this lets us patch not only the
-  // `chr` transition, but also every other transition that leads to this
-  // target state, all in one stroke
-  for (int chr = 0; chr < 256; chr++)
-    if (symset_read(dstate->regex->symset, chr) == dstate->regex->sym_incl)
-      dstate->transitions[chr] = *dstatep;
+  uint8_t *map = (*dfap)->classes->map;
+  if (dstate->transitions[map[chr]])
+    return;
+
+  // every character in the same derivative class as `chr` yields the same
+  // derivative. this lets us patch not only the `chr` transition, but also
+  // every other transition that leads to this target state, all in one stroke
+  struct dstate *target = dfa_target(*dfap, dstate, chr);
+  struct dclasses *dclasses = regex_dclasses(dstate->regex);
+  for (int c = 0; c < 256; c++)
+    if (dclasses->map[c] == dclasses->map[chr])
+      dstate->transitions[map[c]] = target;
 }
 
 bool ltre_matches_lazy(struct dstate **dfap, uint8_t *input) {
@@ -1655,28 +3598,125 @@ bool ltre_matches_lazy(struct dstate **dfap, uint8_t *input) {
   // this regex
 
   struct dstate *dstate = *dfap;
-  for (; *input; dstate = dstate->transitions[*input++])
+  uint8_t *map = dstate->classes->map;
+  for (; *input; dstate = dstate->transitions[map[*input++]])
     dfa_step(dfap, dstate, *input);
 
   return dstate->accepting;
 }
 
-struct dstate *ltre_compile(struct regex *regex) {
-  // fully compile DFA. determinization followed by minimization. calling
-  // `dfa_mark` or `dfa_minimize` after calling this function would be redundant
-  struct dstate *dfa = ltre_determinize(regex);
-  return dfa_minimize(dfa), dfa;
+static size_t ctx_get_memory(void) {
+  // bytes used by the regexes of the current context, along with its
+  // hash-consing and memo tables
+  return ctx->bytes + ctx->interned.cap * sizeof *ctx->interned.slots +
+         ctx->deltas.cap * sizeof *ctx->deltas.slots;
 }
 
-struct dstate *ltre_determinize(struct regex *regex) {
-  // powerset construction, but for Brzozowski derivatives. unlike
-  // `ltre_compile`, doesn't minimize DFAs; only use this function when
-  // DFA minimization becomes a performance bottleneck
+static size_t dfa_get_memory(struct dstate *dfa) {
+  // bytes used by the states of the partial DFA `dfa` and by their index,
+  // assuming the index is up to date. doesn't account for regexes, which are
+  // shared and hash-consed; see `ctx_get_memory`
+  struct dindex *index = dfa->index;
+  size_t dstate_size =
+      sizeof(struct dstate) + dfa->classes->len * sizeof(struct dstate *);
+  return index ? index->len * dstate_size + sizeof *index +
+                     index->cap * sizeof *index->slots
+               : dstate_size;
+}
+
+static void dcache_flush(struct dcache *cache, struct dstate *keep) {
+  // free every state of `cache->dfa` but the initial state and `keep`, and
+  // forget all transitions. this releases the regexes of freed states too
+  struct dstate *dfa = cache->dfa;
+  for (struct dstate *dstate = dfa->next, *next; dstate; dstate = next) {
+    next = dstate->next;
+    if (dstate != keep)
+      regex_decref(dstate->regex), free(dstate);
+  }
+  dfa->next = keep == dfa ? NULL : keep;
+  keep->next = NULL;
+  memset(dfa->transitions, 0x00, dfa->classes->len * sizeof(struct dstate *));
+  memset(keep->transitions, 0x00, dfa->classes->len * sizeof(struct dstate *));
+  free(dfa->index), dfa->index = NULL; // rebuilt by `dfa_step` on first use
+  cache->flushes++;
+}
 
+bool ltre_matches_cached(struct dcache *cache, uint8_t *input) {
+  // like `ltre_matches_lazy`, but bounds the memory used by cached DFA states
+  // to about `cache->budget` bytes, RE2-style: when the cache grows past its
+  // budget, flush it entirely but for the initial and current states, then
+  // carry on. states will be recomputed as needed. `cache->flushes` counts
+  // flushes so that budgets can be tuned; a budget so small that flushes happen
+  // every few input characters is still correct, just slow. call initially
+  // with `*cache = (struct dcache){.dfa = dstate_alloc(regex), .budget = ...}`
+  // and make sure to `dfa_free(cache->dfa)` when finished with this regex
+
+  struct dstate *dstate = cache->dfa;
+  uint8_t *map = dstate->classes->map;
+  for (; *input; input++) {
+    if (dstate->transitions[map[*input]])
+      dstate = dstate->transitions[map[*input]];
+    else if (dfa_step(&cache->dfa, dstate, *input),
+             dstate = dstate->transitions[map[*input]],
+             dfa_get_memory(cache->dfa) > cache->budget)
+      dcache_flush(cache, dstate);
+  }
+
+  return dstate->accepting;
+}
+
+static uint64_t monotonic_ms(void) {
+#ifdef __unix__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+#else
+  // C99 has no wall clock finer than seconds, so make do with processor time
+  return clock() * 1000ull / CLOCKS_PER_SEC;
+#endif
+}
+
+static struct dstate *determinize(struct regex *regex, struct dbudget *budget,
+                                  uint64_t deadline, char **error) {
+  // powerset construction, but for Brzozowski derivatives. when `budget` is
+  // non-`NULL`, give up as soon as it is exceeded. limits are checked once per
+  // state, so they may be overshot by up to one state's worth of transitions.
+  // `deadline` is in `monotonic_ms` units, zero meaning none. memory counts
+  // the regexes that the context grows by, but not those it held already
+
+  size_t base = ctx_get_memory();
+  arena_begin();
   struct dstate *dfa = dstate_alloc(regex);
-  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
+  uint8_t *map = dfa->classes->map;
+
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
+    // differentiate with respect to one representative input character per
+    // derivative class, then fill in the whole row in a single pass
+    struct dclasses *dclasses = regex_dclasses(dstate->regex);
+    uint8_t reps[256];
+    struct dstate *targets[256];
+    for (int chr = 256; chr--;)
+      reps[dclasses->map[chr]] = chr;
+    for (int cls = 0; cls < dclasses->len; cls++)
+      targets[cls] = dfa_target(dfa, dstate, reps[cls]);
     for (int chr = 0; chr < 256; chr++)
-      dfa_step(&dfa, dstate, chr);
+      dstate->transitions[map[chr]] = targets[dclasses->map[chr]];
+
+    if (!budget)
+      continue;
+    size_t grown = ctx_get_memory() > base ? ctx_get_memory() - base : 0;
+    budget->states = dfa->index->len;
+    budget->bytes = dfa_get_memory(dfa) + grown;
+    if (budget->max_states && budget->states > budget->max_states)
+      *error = "state limit exceeded";
+    else if (budget->max_bytes && budget->bytes > budget->max_bytes)
+      *error = "memory limit exceeded";
+    else if (deadline && monotonic_ms() > deadline)
+      *error = "deadline exceeded";
+    else
+      continue;
+    return dfa_free(dfa), arena_end(), NULL;
+  }
 
   // putchar('\n');
   // for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
@@ -1686,20 +3726,1080 @@ struct dstate *ltre_determinize(struct regex *regex) {
   //   // regex_dump(dstate->regex, 0);
   // }
 
+  free(dfa->index), dfa->index = NULL;
   for (struct dstate *dstate = dfa; dstate; dstate = dstate->next)
     dstate->regex = regex_decref(dstate->regex);
 
   // dfa_dump(dfa);
+  return arena_end(), dfa;
+}
+
+struct dstate *ltre_compile(struct regex *regex) {
+  // fully compile DFA. determinization followed by minimization. calling
+  // `dfa_mark` or `dfa_minimize` after calling this function would be redundant
+  struct dstate *dfa = ltre_determinize(regex);
+  return dfa_minimize(dfa), dfa;
+}
+
+struct dstate *ltre_compile_budget(struct regex *regex, struct dbudget *budget,
+                                   char **error) {
+  // like `ltre_compile`, but give up and return `NULL` with `error` set once
+  // determinization exceeds `budget`. either way, `budget` reports the number
+  // of states and bytes reached during determinization. to fall back to lazy
+  // matching on failure, pass in `regex_incref(regex)` and keep `regex` around
+  uint64_t deadline =
+      budget->timeout_ms ? monotonic_ms() + budget->timeout_ms : 0;
+  struct dstate *dfa = determinize(regex, budget, deadline, error);
+  if (dfa && deadline && monotonic_ms() > deadline)
+    *error = "deadline exceeded", dfa_free(dfa), dfa = NULL;
+  return dfa ? dfa_minimize(dfa), dfa : NULL;
+}
+
+struct dstate *ltre_determinize(struct regex *regex) {
+  // unlike `ltre_compile`, doesn't minimize DFAs; only use this function when
+  // DFA minimization becomes a performance bottleneck
+  return determinize(regex, NULL, 0, NULL);
+}
+
+#ifdef __unix__
+// parallel determinization. every worker thread has a context of its own, in
+// which it creates the regexes of the states it discovers. states are shared
+// through a table common to all workers, split into independently locked
+// stripes. regexes of distinct contexts are never the same pointer, so that
+// table compares them structurally, reading regexes of other contexts, which
+// is fine because regexes are immutable once interned; see `regex_alloc`.
+// states waiting to be expanded sit in per-worker deques: workers pop from the
+// back of their own deque, and steal from the front of others' once theirs
+// runs dry. a state stolen from another worker has its regex copied into the
+// context of the thief before being differentiated
+#define PDFA_STRIPES 64 // power of two
+
+struct pworker {
+  struct pdfa *pdfa;
+  pthread_mutex_t lock; // guards the deque
+  struct dstate **deque;
+  size_t head, tail, cap;
+  struct dstate *states, *last; // discovered by this worker, through `next`
+  struct pimport {
+    struct regex *from, *to; // borrowed
+  } *imports;                // see `regex_import`
+  size_t imports_len, imports_cap;
+};
+
+struct pdfa {
+  struct dclasses *classes;
+  pthread_mutex_t lock; // guards `pending`
+  size_t pending;       // states discovered but not yet expanded
+  struct pstripe {
+    pthread_mutex_t lock;
+    struct dindex *index;
+  } stripes[PDFA_STRIPES];
+  int workers_len;
+  struct pworker workers[];
+};
+
+static bool regex_equal(struct regex *regex1, struct regex *regex2) {
+  // deep structural equality, for regexes that may belong to distinct contexts
+  // and whose children therefore can't be compared by pointer. borrows its
+  // arguments
+  if (regex1 == regex2)
+    return true;
+  if (!regex_eq(regex1, regex2->children, regex2))
+    return false; // compares fields only, given the same children
+  struct regex **child1 = regex1->children, **child2 = regex2->children;
+  for (; *child1 && *child2; child1++, child2++)
+    if (!regex_equal(*child1, *child2))
+      return false;
+  return *child1 == *child2;
+}
+
+static struct regex *regex_import(struct pworker *worker, struct regex *regex) {
+  // copy `regex`, which may belong to another context, into the current one.
+  // it's already in normal form, so bypass the smart constructors. shared
+  // subexpressions are memoized in `worker->imports`, which the caller clears.
+  // only reads fields that are immutable; see `regex_alloc`. borrows its
+  // argument
+
+  if (2 * (worker->imports_len + 1) > worker->imports_cap) {
+    struct pimport *imports = worker->imports;
+    size_t cap = worker->imports_cap;
+    worker->imports_cap = cap ? 2 * cap : 256, worker->imports_len = 0;
+    worker->imports = calloc(worker->imports_cap, sizeof *worker->imports);
+    for (size_t i = 0; i < cap; i++)
+      if (imports[i].from) {
+        size_t j = imports[i].from->hash & worker->imports_cap - 1;
+        while (worker->imports[j].from)
+          j = j + 1 & worker->imports_cap - 1;
+        worker->imports[j] = imports[i], worker->imports_len++;
+      }
+    free(imports);
+  }
+
+  size_t i = regex->hash & worker->imports_cap - 1;
+  for (; worker->imports[i].from; i = i + 1 & worker->imports_cap - 1)
+    if (worker->imports[i].from == regex)
+      return regex_incref(worker->imports[i].to);
+
+  struct regex *children[regexes_len(regex->children) + 1];
+  for (int j = 0; j < sizeof children / sizeof *children; j++)
+    children[j] = regex->children[j] ? regex_import(worker, regex->children[j])
+                                     : NULL;
+  struct regex fields = {regex->type, .nullable = regex->nullable,
+                         .size = regex->size, .lower = regex->lower,
+                         .upper = regex->upper};
+  memcpy(fields.symset, regex->symset, sizeof fields.symset);
+  struct regex *import = (regex_alloc)(fields, children);
+
+  // importing children may have grown the memo, so look up the slot anew
+  for (i = regex->hash & worker->imports_cap - 1; worker->imports[i].from;)
+    i = i + 1 & worker->imports_cap - 1;
+  worker->imports[i] = (struct pimport){regex, import}, worker->imports_len++;
+  return import;
+}
+
+static void pworker_push(struct pworker *worker, struct dstate *dstate) {
+  pthread_mutex_lock(&worker->lock);
+  if (worker->tail == worker->cap) {
+    worker->cap = worker->cap ? 2 * worker->cap : 64;
+    worker->deque = realloc(worker->deque, worker->cap * sizeof *worker->deque);
+  }
+  worker->deque[worker->tail++] = dstate;
+  pthread_mutex_unlock(&worker->lock);
+}
+
+static struct dstate *pworker_pop(struct pworker *worker, bool steal) {
+  // pop from the back of the deque of `worker`, or from the front if `steal`
+  struct dstate *dstate = NULL;
+  pthread_mutex_lock(&worker->lock);
+  if (worker->head < worker->tail)
+    dstate = steal ? worker->deque[worker->head++]
+                   : worker->deque[--worker->tail];
+  if (worker->head == worker->tail)
+    worker->head = worker->tail = 0;
+  pthread_mutex_unlock(&worker->lock);
+  return dstate;
+}
+
+static struct pstripe *pdfa_stripe(struct pdfa *pdfa, struct regex *regex) {
+  // `dindex` probes using the low bits of the hash, so use the high bits
+  return &pdfa->stripes[regex->hash >> 24 & PDFA_STRIPES - 1];
+}
+
+static struct dstate *pdfa_target(struct pworker *worker, struct regex *delta) {
+  // find the state for `delta` in the shared table, or create it and queue it
+  // up for expansion if it doesn't exist yet. takes ownership of `delta`
+
+  struct pdfa *pdfa = worker->pdfa;
+  struct pstripe *stripe = pdfa_stripe(pdfa, delta);
+  struct dstate *target = NULL;
+
+  pthread_mutex_lock(&stripe->lock);
+  for (size_t i = stripe->index ? delta->hash & stripe->index->cap - 1 : 0;
+       stripe->index && stripe->index->slots[i] && !target;
+       i = i + 1 & stripe->index->cap - 1)
+    if (regex_equal(stripe->index->slots[i]->regex, delta))
+      target = stripe->index->slots[i];
+  bool found = target;
+  if (!found) {
+    target = dstate_new(delta, pdfa->classes);
+    target->id = worker - pdfa->workers; // owner; see `pdfa_expand`
+    stripe->index = dindex_insert(stripe->index, target);
+  }
+  pthread_mutex_unlock(&stripe->lock);
+
+  if (found)
+    return regex_decref(delta), target;
+
+  worker->last = worker->last ? (worker->last->next = target) : target;
+  worker->states = worker->states ? worker->states : target;
+  pthread_mutex_lock(&pdfa->lock);
+  pdfa->pending++;
+  pthread_mutex_unlock(&pdfa->lock);
+  return pworker_push(worker, target), target;
+}
+
+static void pdfa_expand(struct pworker *worker, struct dstate *dstate) {
+  // fill in the row of `dstate`, like `determinize` does
+
+  struct pdfa *pdfa = worker->pdfa;
+  struct regex *regex;
+  if (dstate->id == worker - pdfa->workers)
+    regex = regex_incref(dstate->regex);
+  else {
+    // stolen, so its regex belongs to another context
+    regex = regex_import(worker, dstate->regex);
+    size_t imports_size = worker->imports_cap * sizeof *worker->imports;
+    memset(worker->imports, 0x00, imports_size), worker->imports_len = 0;
+  }
+
+  struct dclasses *dclasses = regex_dclasses(regex);
+  uint8_t reps[256], *map = pdfa->classes->map;
+  struct dstate *targets[256];
+  for (int chr = 256; chr--;)
+    reps[dclasses->map[chr]] = chr;
+  for (int cls = 0; cls < dclasses->len; cls++)
+    targets[cls] =
+        pdfa_target(worker, regex_differentiate_ref(regex, reps[cls]));
+  for (int chr = 0; chr < 256; chr++)
+    dstate->transitions[map[chr]] = targets[dclasses->map[chr]];
+  regex_decref(regex);
+}
+
+static void *pdfa_work(void *arg) {
+  struct pworker *worker = arg;
+  struct pdfa *pdfa = worker->pdfa;
+  int id = worker - pdfa->workers;
+  // the calling thread is the first worker and keeps its own context
+  struct ltre_ctx *worker_ctx = id ? ltre_ctx_alloc() : NULL;
+  if (worker_ctx)
+    ltre_ctx_use(worker_ctx);
+  arena_begin();
+
+  while (true) {
+    struct dstate *dstate = pworker_pop(worker, false);
+    for (int i = 1; !dstate && i < pdfa->workers_len; i++)
+      dstate = pworker_pop(&pdfa->workers[(id + i) % pdfa->workers_len], true);
+
+    pthread_mutex_lock(&pdfa->lock);
+    bool done = !dstate && !pdfa->pending;
+    pthread_mutex_unlock(&pdfa->lock);
+    if (done)
+      break;
+    if (!dstate) {
+      sched_yield(); // another worker is about to discover more states
+      continue;
+    }
+
+    pdfa_expand(worker, dstate);
+    pthread_mutex_lock(&pdfa->lock);
+    pdfa->pending--;
+    pthread_mutex_unlock(&pdfa->lock);
+  }
+
+  // every state has been expanded, so no other worker will be reading our
+  // regexes anymore
+  for (struct dstate *dstate = worker->states; dstate; dstate = dstate->next)
+    dstate->regex = regex_decref(dstate->regex);
+  arena_end();
+  if (worker_ctx)
+    ltre_ctx_use(NULL), ltre_ctx_free(worker_ctx);
+  return NULL;
+}
+
+struct dstate *ltre_determinize_parallel(struct regex *regex, int threads) {
+  // like `ltre_determinize`, but expand states across `threads` threads, the
+  // calling thread included. yields the same DFA up to the order of states
+
+  if (threads <= 1)
+    return ltre_determinize(regex);
+
+  struct pdfa *pdfa = calloc(1, sizeof *pdfa + threads * sizeof *pdfa->workers);
+  pthread_mutex_init(&pdfa->lock, NULL);
+  for (int i = 0; i < PDFA_STRIPES; i++)
+    pthread_mutex_init(&pdfa->stripes[i].lock, NULL);
+  for (int i = 0; i < threads; i++)
+    pdfa->workers[i].pdfa = pdfa;
+  for (int i = 0; i < threads; i++)
+    pthread_mutex_init(&pdfa->workers[i].lock, NULL);
+  pdfa->workers_len = threads;
+
+  arena_begin(); // so the initial state's regex can be pooled
+  struct dstate *dfa = dstate_alloc(regex);
+  pdfa->classes = dfa->classes, dfa->id = 0;
+  struct pstripe *stripe = pdfa_stripe(pdfa, dfa->regex);
+  stripe->index = dindex_insert(NULL, dfa);
+  pdfa->workers->states = pdfa->workers->last = dfa, pdfa->pending = 1;
+  pworker_push(pdfa->workers, dfa);
+
+  // if a thread can't be created, the other workers will pick up the slack
+  pthread_t tids[threads];
+  bool started[threads];
+  for (int i = 1; i < threads; i++)
+    started[i] = !pthread_create(&tids[i], NULL, pdfa_work, &pdfa->workers[i]);
+  pdfa_work(pdfa->workers);
+  for (int i = 1; i < threads; i++)
+    if (started[i])
+      pthread_join(tids[i], NULL);
+
+  // chain the states back together in breadth-first order, so the order of
+  // states doesn't depend on how the work got scheduled
+  size_t dfa_size = 0;
+  for (int i = 0; i < threads; i++) {
+    struct pworker *worker = &pdfa->workers[i];
+    for (struct dstate *dstate = worker->states; dstate; dstate = dstate->next)
+      dstate->id = -1, dfa_size++;
+    free(worker->deque), free(worker->imports);
+    pthread_mutex_destroy(&worker->lock);
+  }
+  struct dstate **queue = malloc(dfa_size * sizeof *queue);
+  size_t len = 1;
+  queue[0] = dfa, dfa->id = 0;
+  for (size_t i = 0; i < len; i++)
+    for (int cls = 0; cls < dfa->classes->len; cls++)
+      if (queue[i]->transitions[cls]->id == -1)
+        queue[len] = queue[i]->transitions[cls], queue[len]->id = len, len++;
+  for (size_t i = 0; i < dfa_size; i++)
+    queue[i]->next = i + 1 < dfa_size ? queue[i + 1] : NULL;
+  free(queue);
+  for (int i = 0; i < PDFA_STRIPES; i++)
+    free(pdfa->stripes[i].index), pthread_mutex_destroy(&pdfa->stripes[i].lock);
+  pthread_mutex_destroy(&pdfa->lock), free(pdfa);
+  return arena_end(), dfa;
+}
+#else
+struct dstate *ltre_determinize_parallel(struct regex *regex, int threads) {
+  return ltre_determinize(regex); // no threads to speak of
+}
+#endif
+
+struct dstate *ltre_compile_parallel(struct regex *regex, int threads) {
+  // like `ltre_compile`, but see `ltre_determinize_parallel` and
+  // `dfa_minimize_parallel`
+  struct dstate *dfa = ltre_determinize_parallel(regex, threads);
+  return dfa_minimize_parallel(dfa, threads), dfa;
+}
+
+// minimal acyclic DFA construction for finite sets of strings, after Daciuk,
+// Mihov, Watson and Watson. strings are added in lexicographic order, so only
+// the states along the path of the string last added can still change. when
+// the next string comes in, the states of that path past the common prefix of
+// both strings are complete, and each gets replaced by an equivalent state
+// from the register if there is one, or else is registered. the automaton is
+// thus minimal at all times but for the current path. states have sparse
+// transitions to keep memory usage low; see `ltre_compile_strings`
+struct dedge {
+  uint8_t chr;
+  int target;
+};
+
+struct dnode {
+  bool accepting;
+  int len, cap; // of `edges`, which are sorted by character
+  struct dedge *edges;
+};
+
+struct dtrie {
+  struct dnode *nodes;
+  int len, cap;
+  int *spare, spare_len, spare_cap; // identifiers of freed nodes
+  int *slots, slots_len, slots_cap; // the register. open addressing
+};
+
+static int dtrie_node(struct dtrie *trie) {
+  // allocate a fresh node, reusing freed ones first
+  int id = trie->spare_len ? trie->spare[--trie->spare_len] : trie->len++;
+  if (trie->len > trie->cap)
+    trie->cap = trie->cap ? 2 * trie->cap : 64,
+    trie->nodes = realloc(trie->nodes, trie->cap * sizeof *trie->nodes);
+  return trie->nodes[id] = (struct dnode){0}, id;
+}
+
+static size_t dtrie_hash(struct dnode *node) {
+  // FNV-1a over the accepting flag and the edges
+  size_t hash = 2166136261u ^ node->accepting;
+  for (int i = 0; i < node->len; i++)
+    hash = (hash ^ node->edges[i].chr) * 16777619u,
+    hash = (hash ^ node->edges[i].target) * 16777619u;
+  return hash;
+}
+
+static bool dtrie_eq(struct dnode *node1, struct dnode *node2) {
+  // field by field, as edges have padding
+  if (node1->accepting != node2->accepting || node1->len != node2->len)
+    return false;
+  for (int i = 0; i < node1->len; i++)
+    if (node1->edges[i].chr != node2->edges[i].chr ||
+        node1->edges[i].target != node2->edges[i].target)
+      return false;
+  return true;
+}
+
+static int dtrie_register(struct dtrie *trie, int id) {
+  // return the registered node equivalent to `id`, registering `id` if there
+  // is none. the register is kept at most half full
+  if (2 * (trie->slots_len + 1) > trie->slots_cap) {
+    int cap = trie->slots_cap ? 2 * trie->slots_cap : 64, *slots = trie->slots;
+    trie->slots = malloc(cap * sizeof *trie->slots);
+    for (int i = 0; i < cap; i++)
+      trie->slots[i] = -1;
+    for (int i = 0; i < trie->slots_cap; i++)
+      if (slots[i] != -1) {
+        size_t j = dtrie_hash(&trie->nodes[slots[i]]) & cap - 1;
+        while (trie->slots[j] != -1)
+          j = j + 1 & cap - 1;
+        trie->slots[j] = slots[i];
+      }
+    free(slots), trie->slots_cap = cap;
+  }
+
+  struct dnode *node = &trie->nodes[id];
+  size_t i = dtrie_hash(node) & trie->slots_cap - 1;
+  for (; trie->slots[i] != -1; i = i + 1 & trie->slots_cap - 1)
+    if (dtrie_eq(&trie->nodes[trie->slots[i]], node))
+      return trie->slots[i];
+  return trie->slots_len++, trie->slots[i] = id;
+}
+
+static void dtrie_minimize(struct dtrie *trie, int path[], int from, int to) {
+  // replace or register the nodes `path[from + 1..to]`, deepest first
+  for (int depth = to; depth > from; depth--) {
+    struct dnode *parent = &trie->nodes[path[depth - 1]];
+    int id = path[depth], reg = dtrie_register(trie, id);
+    if (reg == id)
+      continue;
+    free(trie->nodes[id].edges), trie->nodes[id] = (struct dnode){0};
+    if (trie->spare_len == trie->spare_cap)
+      trie->spare_cap = trie->spare_cap ? 2 * trie->spare_cap : 64,
+      trie->spare = realloc(trie->spare, trie->spare_cap * sizeof *trie->spare);
+    trie->spare[trie->spare_len++] = id;
+    parent->edges[parent->len - 1].target = reg;
+  }
+}
+
+static int strings_order(const void *string1, const void *string2) {
+  return strcmp(*(char **)string1, *(char **)string2);
+}
+
+struct dstate *ltre_compile_strings(char *strings[], size_t len) {
+  // compile a DFA that accepts exactly the `len` strings of `strings`, which
+  // may come in any order and may contain duplicates. the DFA is minimal and
+  // marked, as from `ltre_compile`, but skips regexes entirely so it scales to
+  // millions of strings. borrows `strings`
+
+  char **sorted = malloc((len + 1) * sizeof *sorted);
+  for (size_t i = 0; i < len; i++)
+    sorted[i] = strings[i];
+  qsort(sorted, len, sizeof *sorted, strings_order);
+
+  struct dtrie trie = {0};
+  int root = dtrie_node(&trie), depth = 0, path_cap = 16;
+  int *path = malloc(path_cap * sizeof *path);
+  *path = root;
+  for (size_t i = 0; i < len; i++) {
+    if (i && strcmp(sorted[i - 1], sorted[i]) == 0)
+      continue;
+    uint8_t *string = (uint8_t *)sorted[i];
+    int prefix = 0;
+    while (prefix < depth && string[prefix] &&
+           trie.nodes[path[prefix]].edges[trie.nodes[path[prefix]].len - 1]
+                   .chr == string[prefix])
+      prefix++;
+    dtrie_minimize(&trie, path, prefix, depth);
+
+    // append the remaining suffix as a chain of fresh nodes
+    for (depth = prefix; string[depth]; depth++) {
+      if (depth + 2 > path_cap)
+        path_cap *= 2, path = realloc(path, path_cap * sizeof *path);
+      int id = dtrie_node(&trie);
+      struct dnode *node = &trie.nodes[path[depth]];
+      if (node->len == node->cap)
+        node->cap = node->cap ? 2 * node->cap : 2,
+        node->edges = realloc(node->edges, node->cap * sizeof *node->edges);
+      node->edges[node->len++] = (struct dedge){string[depth], id};
+      path[depth + 1] = id;
+    }
+    trie.nodes[path[depth]].accepting = true;
+  }
+  dtrie_minimize(&trie, path, 0, depth);
+  free(sorted), free(path), free(trie.spare), free(trie.slots);
+
+  // every character that labels an edge gets its own class, and all others
+  // share one. classes are numbered in order of their smallest character
+  bool used[256] = {0};
+  for (int id = 0; id < trie.len; id++)
+    for (int i = 0; i < trie.nodes[id].len; i++)
+      used[trie.nodes[id].edges[i].chr] = true;
+  struct dclasses *classes = malloc(sizeof *classes);
+  *classes = (struct dclasses){.len = 0};
+  int other = -1;
+  for (int chr = 0; chr < 256; chr++)
+    classes->map[chr] = used[chr]       ? classes->len++
+                        : other == -1 ? (other = classes->len++)
+                                      : other;
+
+  // breadth-first from the root so states come in the order `dfa_equivalent`
+  // expects. missing edges lead to the dead state, which is appended once it
+  // is first needed. every other state reaches an accepting state, so only
+  // the dead state is terminating. `dstate.id` holds node identifiers
+  struct dstate **dstates = calloc(trie.len, sizeof *dstates);
+  struct dstate *dead = dstate_new(NULL, classes), *dfa = dead, *tail = dead;
+  bool dead_linked = true;
+  dead->terminating = true;
+  for (int cls = 0; cls < classes->len; cls++)
+    dead->transitions[cls] = dead;
+  if (trie.nodes[root].accepting || trie.nodes[root].len)
+    dfa = tail = dstates[root] = dstate_new(NULL, classes), dfa->id = root,
+    dead_linked = false;
+
+  for (struct dstate *dstate = dfa; dstate; dstate = dstate->next) {
+    if (dstate == dead)
+      continue;
+    struct dnode *node = &trie.nodes[dstate->id];
+    dstate->accepting = node->accepting;
+    for (int i = 0; i < node->len; i++) {
+      int target = node->edges[i].target;
+      if (!dstates[target])
+        dstates[target] = dstate_new(NULL, classes),
+        dstates[target]->id = target, tail = tail->next = dstates[target];
+      dstate->transitions[classes->map[node->edges[i].chr]] = dstates[target];
+    }
+    for (int cls = 0; cls < classes->len; cls++)
+      if (!dstate->transitions[cls])
+        dstate->transitions[cls] = dead,
+        tail = dead_linked ? tail : (dead_linked = true, tail->next = dead);
+  }
+
+  for (int id = 0; id < trie.len; id++)
+    free(trie.nodes[id].edges);
+  free(trie.nodes), free(dstates);
   return dfa;
 }
 
 bool ltre_matches(struct dstate *dfa, uint8_t *input) {
   // time linear in the input length :)
-  while (!dfa->terminating && *input)
-    dfa = dfa->transitions[*input++];
+  uint8_t *map = dfa->classes->map;
+  while (!dfa->terminating && *input) {
+    // accelerated state. skip to the next exit character, or to the end of
+    // the input. a leading zero exit byte would end the set early, so skip it
+    if (dfa->nexits &&
+        !*(input += strcspn((char *)input, (char *)dfa->exits + !*dfa->exits)))
+      break;
+    dfa = dfa->transitions[map[*input++]];
+  }
   return dfa->accepting;
 }
 
+bool ltre_matches_table(struct dtable *dtable, uint8_t *input) {
+  // like `ltre_matches`, but through a `struct dtable`
+  uint32_t id = dtable->initial;
+  dtable_run(dtable, &id, input, input + strlen((char *)input), EOF);
+  return dtable_accepting(dtable, id);
+}
+
+// counting automaton: a Thompson NFA in which every repetition of a symset,
+// as in /\d{1,500}/ or /(~\n){4096}/, is a single node holding a counting set
+// instead of one state per count. DFAs for such patterns need a state per
+// reachable combination of counts, but a counting set only needs to remember
+// when each of its active counters was entered. every input character either
+// belongs to the symset, in which case all counters go up by one, or it
+// doesn't, in which case they're all cleared. so a counter's value is just the
+// number of characters read since it was entered, and keeping entry times in
+// a queue, oldest first, makes every counting set operation O(1) amortized.
+// after Turoňová et al., "Regex Matching with Counting-Set Automata". other
+// repetitions are unrolled. complements can't be expressed in an NFA, save for
+// /%/ and /(!)/, which are repetitions of /./
+#define CNFA_MAX_NODES (1 << 20)
+#define CNFA_MAX_COUNT (1 << 20) // entries per counting set
+
+struct cnode {
+  enum { CNODE_SYMSET, CNODE_SPLIT, CNODE_COUNT, CNODE_ACCEPT } type;
+  int out, out2;         // successors; `out2` only for `CNODE_SPLIT`
+  size_t mark;           // last step at which the node was visited, plus one
+  symset_t symset;       // for `CNODE_SYMSET` and `CNODE_COUNT`
+  unsigned lower, upper; // for `CNODE_COUNT`. `upper == 0` means unbounded
+  // counting set for `CNODE_COUNT`: ring buffer of entry steps, oldest first
+  size_t *entries, head, len, cap;
+};
+
+struct cnfa {
+  struct cnode *nodes;
+  int len, cap, start;
+  int *syms, *counts, *stack; // scratch space for `ltre_matches_counting`
+};
+
+static int cnfa_node(struct cnfa *cnfa, struct cnode node, char **error) {
+  // append a node and return its index, or -1 with `error` set
+  if (cnfa->len == CNFA_MAX_NODES)
+    return *error = "automaton too large", -1;
+  if (cnfa->len == cnfa->cap) {
+    cnfa->cap = cnfa->cap ? 2 * cnfa->cap : 64;
+    cnfa->nodes = realloc(cnfa->nodes, cnfa->cap * sizeof *cnfa->nodes);
+  }
+  return cnfa->nodes[cnfa->len] = node, cnfa->len++;
+}
+
+static int cnfa_count(struct cnfa *cnfa, symset_t symset, unsigned lower,
+                      unsigned upper, int next, char **error) {
+  // a counter never needs to exceed the upper bound, or the lower bound if
+  // there is no upper bound, so there are at most that many plus one entries
+  struct cnode node = {CNODE_COUNT, next, .lower = lower, .upper = upper};
+  memcpy(node.symset, symset, sizeof node.symset);
+  node.cap = (size_t)(upper ? upper : lower) + 1;
+  if (node.cap > CNFA_MAX_COUNT)
+    return *error = "repetition bound too large", -1;
+  if (!(node.entries = malloc(node.cap * sizeof *node.entries)))
+    return *error = "out of memory", -1;
+  int count = cnfa_node(cnfa, node, error);
+  if (count == -1)
+    free(node.entries);
+  return count;
+}
+
+static int cnfa_build(struct cnfa *cnfa, struct regex *regex, int next,
+                      char **error) {
+  // build the nodes for `regex` in continuation-passing style: return the
+  // node to start from in order to match `regex` then carry on from `next`.
+  // -1 means failure, and must be propagated. borrows its argument
+
+  symset_t all;
+  memset(all, 0xff, sizeof all);
+  if (next == -1)
+    return -1;
+
+  switch (regex->type) {
+  case TYPE_SYMSET: {
+    struct cnode node = {CNODE_SYMSET, next};
+    memcpy(node.symset, regex->symset, sizeof node.symset);
+    return cnfa_node(cnfa, node, error);
+  }
+  case TYPE_CONCAT:
+    for (int i = regexes_len(regex->children); i--;)
+      next = cnfa_build(cnfa, regex->children[i], next, error);
+    return next;
+  case TYPE_ALT: {
+    // a split per child but the last. the empty alternation matches nothing
+    if (!*regex->children)
+      return cnfa_node(cnfa, (struct cnode){CNODE_SYMSET, next}, error);
+    int i = regexes_len(regex->children) - 1;
+    int start = cnfa_build(cnfa, regex->children[i], next, error);
+    while (i-- && start != -1)
+      start = cnfa_node(
+          cnfa,
+          (struct cnode){CNODE_SPLIT,
+                         cnfa_build(cnfa, regex->children[i], next, error),
+                         start},
+          error);
+    return start;
+  }
+  case TYPE_COMPL:
+    if (regex == regex_univ())
+      return cnfa_count(cnfa, all, 0, 0, next, error); // % is .*
+    if (regex == regex_negeps())
+      return cnfa_count(cnfa, all, 1, 0, next, error); // (!) is .+
+    return *error = "complement not supported", -1;
+  case TYPE_REPEAT:;
+    struct regex *child = *regex->children;
+    unsigned lower = regex->lower, upper = regex->upper;
+    if (child->type == TYPE_SYMSET)
+      return cnfa_count(cnfa, child->symset, lower, upper, next, error);
+
+    // r{m,n} is r{m} followed by n-m nested optional copies of r, and r{m,}
+    // is r{m} followed by r*, which needs a cycle through a split
+    int start = next;
+    if (!upper) {
+      start = cnfa_node(cnfa, (struct cnode){CNODE_SPLIT, -1, next}, error);
+      int body = cnfa_build(cnfa, child, start, error);
+      if (body == -1)
+        return -1;
+      cnfa->nodes[start].out = body;
+    } else
+      for (unsigned i = lower; i < upper && start != -1; i++)
+        start = cnfa_node(cnfa,
+                          (struct cnode){CNODE_SPLIT,
+                                         cnfa_build(cnfa, child, start, error),
+                                         next},
+                          error);
+    for (unsigned i = 0; i < lower && start != -1; i++)
+      start = cnfa_build(cnfa, child, start, error);
+    return start;
+  }
+
+  abort(); // should have diverged
+}
+
+struct cnfa *cnfa_alloc(struct regex *regex, char **error) {
+  // build a counting automaton for `regex`, or return `NULL` with `error` set
+  // if `regex` contains complements or the automaton would be too large. see
+  // `ltre_matches_counting`. takes ownership of `regex`
+
+  struct cnfa *cnfa = calloc(1, sizeof *cnfa);
+  char *err = NULL; // failures may leave dangling nodes behind, so check this
+  int accept = cnfa_node(cnfa, (struct cnode){CNODE_ACCEPT}, &err);
+  cnfa->start = cnfa_build(cnfa, regex, accept, &err);
+  regex_decref(regex);
+  if (err)
+    return *error = err, cnfa_free(cnfa), NULL;
+
+  // every node visited pushes at most two more onto the stack
+  cnfa->syms = malloc(cnfa->len * sizeof *cnfa->syms);
+  cnfa->counts = malloc(cnfa->len * sizeof *cnfa->counts);
+  cnfa->stack = malloc(3 * cnfa->len * sizeof *cnfa->stack);
+  return cnfa;
+}
+
+void cnfa_free(struct cnfa *cnfa) {
+  for (int i = 0; i < cnfa->len; i++)
+    free(cnfa->nodes[i].entries);
+  free(cnfa->nodes), free(cnfa->syms), free(cnfa->counts), free(cnfa->stack);
+  free(cnfa);
+}
+
+static bool cnfa_close(struct cnfa *cnfa, int *stack, int len, size_t step,
+                       int *nsyms, int *ncounts) {
+  // visit the nodes on `stack` and everything reachable from them without
+  // reading input, at step `step`. collect symset nodes to read the next
+  // character with and enter counting sets. returns whether the accepting
+  // node was reached
+  bool accepting = false;
+  while (len) {
+    struct cnode *node = &cnfa->nodes[stack[--len]];
+    if (node->mark == step + 1)
+      continue;
+    node->mark = step + 1;
+
+    switch (node->type) {
+    case CNODE_SYMSET:
+      cnfa->syms[(*nsyms)++] = node - cnfa->nodes;
+      break;
+    case CNODE_SPLIT:
+      stack[len++] = node->out2, stack[len++] = node->out;
+      break;
+    case CNODE_COUNT:
+      // a fresh counter at zero, unless one was already entered this step
+      if (!node->len)
+        cnfa->counts[(*ncounts)++] = node - cnfa->nodes;
+      if (!node->len || node->entries[(node->head + node->len - 1) %
+                                      node->cap] != step)
+        node->entries[(node->head + node->len++) % node->cap] = step;
+      if (node->lower == 0)
+        stack[len++] = node->out;
+      break;
+    case CNODE_ACCEPT:
+      accepting = true;
+    }
+  }
+  return accepting;
+}
+
+bool ltre_matches_counting(struct cnfa *cnfa, uint8_t *input) {
+  // simulate the counting automaton `cnfa`, in time linear in the input length
+  // and proportional to the number of nodes. counting sets take memory linear
+  // in the bounds of their repetitions, but the number of states doesn't
+  // blow up with them. call initially with `cnfa = cnfa_alloc(regex, &error)`
+  // and make sure to `cnfa_free(cnfa)` when finished with this regex
+
+  for (int i = 0; i < cnfa->len; i++)
+    cnfa->nodes[i].mark = 0, cnfa->nodes[i].len = 0;
+
+  int nsyms = 0, ncounts = 0, *stack = cnfa->stack;
+  *stack = cnfa->start;
+  bool accepting = cnfa_close(cnfa, stack, 1, 0, &nsyms, &ncounts);
+  for (size_t step = 1; *input && (nsyms || ncounts); input++, step++) {
+    // read one character into `stack`, then close over it. symset nodes are
+    // only ever collected once per step, and so are counting sets, so
+    // `stack` never holds more than one entry per node before closing
+    int len = 0, old_ncounts = ncounts;
+    for (int i = 0; i < nsyms; i++)
+      if (symset_read(cnfa->nodes[cnfa->syms[i]].symset, *input))
+        stack[len++] = cnfa->nodes[cnfa->syms[i]].out;
+
+    ncounts = 0;
+    for (int i = 0; i < old_ncounts; i++) {
+      struct cnode *node = &cnfa->nodes[cnfa->counts[i]];
+      if (!symset_read(node->symset, *input)) {
+        node->len = 0;
+        continue;
+      }
+      // drop counters that went over the upper bound. without an upper
+      // bound, counters that went over the lower bound are all equivalent,
+      // so only keep the youngest of those
+#define OLDEST(N) (step - node->entries[(node->head + (N)) % node->cap])
+      while (node->len && node->upper && OLDEST(0) > node->upper)
+        node->head = (node->head + 1) % node->cap, node->len--;
+      while (node->len > 1 && !node->upper && OLDEST(1) >= node->lower)
+        node->head = (node->head + 1) % node->cap, node->len--;
+      if (node->len && OLDEST(0) >= node->lower)
+        stack[len++] = node->out;
+#undef OLDEST
+      if (node->len)
+        cnfa->counts[ncounts++] = node - cnfa->nodes;
+    }
+
+    nsyms = 0;
+    accepting = cnfa_close(cnfa, stack, len, step, &nsyms, &ncounts);
+  }
+
+  return accepting && !*input;
+}
+
+// bit-parallel Glushkov automaton, or position automaton: a state per
+// position, that is, per symset occurrence once repetitions are unrolled, plus
+// the start state 0. it has no epsilon transitions and every transition into a
+// position reads a character of its symset, so the set of active states is a
+// bitset that steps with `next = follow(state) & masks[chr]`. positions are
+// numbered left to right, so most follow edges go from a position to the next
+// one, and those are taken for all positions at once by a shift, as in shift-
+// and. the other edges, those closing loops or leaving alternatives, go
+// through tables that map each byte of the bitset to the union of the follow
+// sets of its positions. after Navarro and Raffinot, "New Techniques for
+// Regular Expression Searching". DFAs for patterns like /%a.{30}/ have
+// exponentially many states, but this automaton has one per position. fall
+// back to it when `ltre_compile_budget` gives up. complements can't be
+// expressed, save for /%/ and /(!)/, as for counting automata
+#define GNFA_MAX_POSITIONS 511 // plus the start state, for 8 words
+
+struct gnfa {
+  int len, words;           // positions, and 64-bit words per bitset
+  uint64_t *masks;          // `256 * words`, positions whose symset has `chr`
+  uint64_t *shift, *accept; // positions followed by the next one, and last
+  uint64_t **tables;        // `256 * words` per byte of the bitset, or `NULL`
+  int *chunks, nchunks;     // bytes of the bitset that have a table
+  uint64_t *state, *next;   // scratch space for `ltre_matches_glushkov`
+};
+
+static unsigned gnfa_count(struct regex *regex) {
+  // number of positions of `regex`, saturating past `GNFA_MAX_POSITIONS`. see
+  // `gnfa_build` for repetitions
+  unsigned count = 0;
+  switch (regex->type) {
+  case TYPE_SYMSET:
+  case TYPE_COMPL:
+    return 1;
+  case TYPE_CONCAT:
+  case TYPE_ALT:
+    for (struct regex **child = regex->children; *child; child++)
+      if ((count += gnfa_count(*child)) > GNFA_MAX_POSITIONS)
+        break;
+    return count;
+  case TYPE_REPEAT:;
+    unsigned copies = regex->upper   ? regex->upper
+                      : regex->lower ? regex->lower
+                                     : 1;
+    count = gnfa_count(*regex->children);
+    return count && copies > GNFA_MAX_POSITIONS / count
+               ? GNFA_MAX_POSITIONS + 1
+               : copies * count;
+  }
+  abort(); // should have diverged
+}
+
+static void gnfa_link(struct gnfa *gnfa, uint64_t *follow, uint64_t *from,
+                      uint64_t *to) {
+  // add `to` to the follow set of every position in `from`
+  for (int pos = 0; pos <= gnfa->len; pos++)
+    if (from[pos / 64] >> pos % 64 & 1)
+      for (int w = 0; w < gnfa->words; w++)
+        follow[pos * gnfa->words + w] |= to[w];
+}
+
+static void gnfa_append(struct gnfa *gnfa, uint64_t *follow, uint64_t *first,
+                        uint64_t *last, bool *nullable, uint64_t *cfirst,
+                        uint64_t *clast, bool cnullable) {
+  // concatenate a child with sets `cfirst`, `clast` and `cnullable` onto the
+  // sets `first`, `last` and `nullable`
+  gnfa_link(gnfa, follow, last, cfirst);
+  for (int w = 0; w < gnfa->words; w++)
+    first[w] |= *nullable ? cfirst[w] : 0,
+        last[w] = cnullable ? last[w] | clast[w] : clast[w];
+  *nullable &= cnullable;
+}
+
+static bool gnfa_build(struct gnfa *gnfa, uint64_t *follow,
+                       struct regex *regex, uint64_t *first, uint64_t *last,
+                       bool *nullable, char **error) {
+  // allocate positions for `regex` and add the follow edges between them, then
+  // store into `first` and `last` the positions its words may start and end
+  // on and into `nullable` whether it matches the empty word. returns `false`
+  // with `error` set on failure. borrows its argument
+  int words = gnfa->words;
+  memset(first, 0, words * sizeof *first);
+  memset(last, 0, words * sizeof *last);
+  *nullable = false;
+  uint64_t *cfirst = malloc(2 * words * sizeof *cfirst);
+  uint64_t *clast = cfirst + words;
+  bool cnullable, ok = true;
+  int pos;
+
+  switch (regex->type) {
+  case TYPE_SYMSET:
+    pos = ++gnfa->len;
+    for (int chr = 0; chr < 256; chr++)
+      if (symset_read(regex->symset, chr))
+        gnfa->masks[chr * words + pos / 64] |= 1ull << pos % 64;
+    first[pos / 64] = last[pos / 64] = 1ull << pos % 64;
+    break;
+
+  case TYPE_CONCAT:
+    *nullable = true;
+    for (struct regex **child = regex->children; ok && *child; child++)
+      if ((ok = gnfa_build(gnfa, follow, *child, cfirst, clast, &cnullable,
+                           error)))
+        gnfa_append(gnfa, follow, first, last, nullable, cfirst, clast,
+                    cnullable);
+    break;
+
+  case TYPE_ALT:
+    // the empty alternation has no positions and matches nothing
+    for (struct regex **child = regex->children; ok && *child; child++) {
+      if (!(ok = gnfa_build(gnfa, follow, *child, cfirst, clast, &cnullable,
+                            error)))
+        break;
+      for (int w = 0; w < words; w++)
+        first[w] |= cfirst[w], last[w] |= clast[w];
+      *nullable |= cnullable;
+    }
+    break;
+
+  case TYPE_COMPL:
+    // % is .* and (!) is .+, a single position with a loop
+    if (regex != regex_univ() && regex != regex_negeps()) {
+      *error = "complement not supported", ok = false;
+      break;
+    }
+    pos = ++gnfa->len;
+    for (int chr = 0; chr < 256; chr++)
+      gnfa->masks[chr * words + pos / 64] |= 1ull << pos % 64;
+    first[pos / 64] = last[pos / 64] = 1ull << pos % 64;
+    gnfa_link(gnfa, follow, last, first);
+    *nullable = regex == regex_univ();
+    break;
+
+  case TYPE_REPEAT:;
+    // r{m,n} is m copies of r followed by n-m optional copies, and r{m,} is
+    // m-1 copies of r followed by r+, or just r* when m is zero. every copy
+    // gets positions of its own
+    unsigned lower = regex->lower, upper = regex->upper;
+    unsigned copies = upper ? upper : lower ? lower : 1;
+    *nullable = true;
+    for (unsigned i = 0; ok && i < copies; i++) {
+      if (!(ok = gnfa_build(gnfa, follow, *regex->children, cfirst, clast,
+                            &cnullable, error)))
+        break;
+      if (!upper && i == copies - 1)
+        gnfa_link(gnfa, follow, clast, cfirst);
+      bool optional = upper ? i >= lower : lower == 0;
+      gnfa_append(gnfa, follow, first, last, nullable, cfirst, clast,
+                  cnullable || optional);
+    }
+    break;
+  }
+
+  free(cfirst);
+  return ok;
+}
+
+struct gnfa *gnfa_alloc(struct regex *regex, char **error) {
+  // build a bit-parallel Glushkov automaton for `regex`, or return `NULL` with
+  // `error` set if `regex` contains complements or has more than
+  // `GNFA_MAX_POSITIONS` positions. see `ltre_matches_glushkov`. takes
+  // ownership of `regex`
+  unsigned count = gnfa_count(regex);
+  if (count > GNFA_MAX_POSITIONS)
+    return *error = "automaton too large", regex_decref(regex), NULL;
+
+  struct gnfa *gnfa = calloc(1, sizeof *gnfa);
+  int words = gnfa->words = count / 64 + 1; // and the start state
+  gnfa->masks = calloc(256 * words, sizeof *gnfa->masks);
+  uint64_t *follow = calloc((count + 1) * words, sizeof *follow);
+  uint64_t *first = calloc(2 * words, sizeof *first), *last = first + words;
+  bool nullable, ok = gnfa_build(gnfa, follow, regex, first, last, &nullable,
+                                 error);
+  regex_decref(regex);
+  if (!ok)
+    return free(follow), free(first), gnfa_free(gnfa), NULL;
+
+  // the start state is followed by the first positions, and is accepting if
+  // the empty word is matched
+  memcpy(follow, first, words * sizeof *follow);
+  gnfa->accept = calloc(words, sizeof *gnfa->accept);
+  memcpy(gnfa->accept, last, words * sizeof *last);
+  gnfa->accept[0] |= nullable;
+
+  // split follow edges into shifts and the rest, and tabulate the rest
+  gnfa->shift = calloc(words, sizeof *gnfa->shift);
+  gnfa->tables = calloc(words * 8, sizeof *gnfa->tables);
+  for (int pos = 0; pos <= gnfa->len; pos++) {
+    uint64_t *row = follow + pos * words;
+    int succ = pos + 1;
+    if (succ <= gnfa->len && row[succ / 64] >> succ % 64 & 1)
+      row[succ / 64] &= ~(1ull << succ % 64),
+          gnfa->shift[pos / 64] |= 1ull << pos % 64;
+    bool rest = false;
+    for (int w = 0; w < words; w++)
+      rest |= row[w] != 0;
+    uint64_t **table = &gnfa->tables[pos / 8];
+    if (rest && !*table)
+      *table = calloc(256 * words, sizeof **table);
+  }
+  // each byte value is that value without its lowest bit, plus one more row
+  for (int k = 0; k < words * 8; k++)
+    for (int byte = 1; gnfa->tables[k] && byte < 256; byte++) {
+      int low = 0;
+      while (!(byte >> low & 1))
+        low++;
+      uint64_t *row = follow + (k * 8 + low) * words;
+      for (int w = 0; w < words; w++)
+        gnfa->tables[k][byte * words + w] =
+            gnfa->tables[k][(byte & (byte - 1)) * words + w] |
+            (k * 8 + low <= gnfa->len ? row[w] : 0);
+    }
+
+  gnfa->chunks = malloc(words * 8 * sizeof *gnfa->chunks);
+  for (int k = 0; k < words * 8; k++)
+    if (gnfa->tables[k])
+      gnfa->chunks[gnfa->nchunks++] = k;
+
+  free(follow), free(first);
+  gnfa->state = malloc(2 * words * sizeof *gnfa->state);
+  gnfa->next = gnfa->state + words;
+  return gnfa;
+}
+
+void gnfa_free(struct gnfa *gnfa) {
+  for (int k = 0; gnfa->tables && k < gnfa->words * 8; k++)
+    free(gnfa->tables[k]);
+  free(gnfa->masks), free(gnfa->shift), free(gnfa->accept);
+  free(gnfa->tables), free(gnfa->chunks), free(gnfa->state), free(gnfa);
+}
+
+bool ltre_matches_glushkov(struct gnfa *gnfa, uint8_t *input) {
+  // simulate the Glushkov automaton `gnfa`, in time linear in the input length
+  // and proportional to the number of words per bitset. call initially with
+  // `gnfa = gnfa_alloc(regex, &error)` and make sure to `gnfa_free(gnfa)` when
+  // finished with this regex
+  int words = gnfa->words, nchunks = gnfa->nchunks, *chunks = gnfa->chunks;
+  uint64_t *state = gnfa->state, *next = gnfa->next, *swap, any = 1;
+  uint64_t *shift = gnfa->shift, *masks = gnfa->masks, **tables = gnfa->tables;
+  memset(state, 0, words * sizeof *state), *state = 1;
+
+  if (words == 1) {
+    // the common case, with the bitset in a register. byte 0 of every table
+    // is empty, so there is no need to branch on it
+    uint64_t state1 = 1;
+    for (; *input && state1; input++) {
+      uint64_t next1 = (state1 & *shift) << 1;
+      for (int i = 0; i < nchunks; i++)
+        next1 |= tables[chunks[i]][state1 >> chunks[i] * 8 & 0xff];
+      state1 = next1 & masks[*input];
+    }
+    return (state1 & *gnfa->accept) && !*input;
+  }
+
+  for (; *input && any; input++) {
+    uint64_t carry = 0;
+    for (int w = 0; w < words; w++) {
+      uint64_t shifted = state[w] & shift[w];
+      next[w] = shifted << 1 | carry, carry = shifted >> 63;
+    }
+    for (int i = 0; i < nchunks; i++) {
+      uint8_t byte = state[chunks[i] / 8] >> chunks[i] % 8 * 8;
+      uint64_t *row = tables[chunks[i]] + byte * words;
+      for (int w = 0; byte && w < words; w++)
+        next[w] |= row[w];
+    }
+    uint64_t *mask = masks + *input * words;
+    any = 0;
+    for (int w = 0; w < words; w++)
+      next[w] &= mask[w], any |= next[w];
+    swap = state, state = next, next = swap;
+  }
+
+  bool accepting = false;
+  for (int w = 0; w < words; w++)
+    accepting |= (state[w] & gnfa->accept[w]) != 0;
+  return accepting && !*input;
+}
+
 struct regex *ltre_decompile(struct dstate *dfa) {
   // convert a DFA into a regular expression using the classic construction,
   // turning the DFA into a GNFA stored as a matrix of `arrow`s on the stack
@@ -1727,7 +4827,7 @@ struct regex *ltre_decompile(struct dstate *dfa) {
       bool empty = true;
       symset_t transitions = {0};
       for (int chr = 0; chr < 256; chr++)
-        if (ds1->transitions[chr] == ds2)
+        if (ds1->transitions[dfa->classes->map[chr]] == ds2)
           symset_write(transitions, chr, true), empty = false;
 
       arrows[ds1->id][ds2->id] = NULL;
@@ -1780,7 +4880,7 @@ struct regex *ltre_decompile(struct dstate *dfa) {
           continue; // outbound transition doesn't exist or is a self-loop
 
         // it's okay not to `regex_decref(bypass)` when throwing it away because
-        // `regex_eps` always returns the same static pointer
+        // `regex_eps` always returns the same pinned pointer
         struct regex *bypass = regex_eps();
 
         // construct /(self)*/. note that []* |- ()
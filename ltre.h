@@ -12,6 +12,14 @@ inline void symset_write(symset_t symset, unsigned chr, bool val) {
 }
 char *symset_fmt(symset_t symset);
 
+// regexes belong to the calling thread's current context, which defaults to
+// one shared by all threads. `ltre_ctx_use` returns the previous context, and
+// `NULL` stands for the default context. a context must be used by one thread
+// at a time, and must outlive its regexes and its lazily constructed DFAs
+struct ltre_ctx *ltre_ctx_alloc(void);
+void ltre_ctx_free(struct ltre_ctx *ctx);
+struct ltre_ctx *ltre_ctx_use(struct ltre_ctx *ctx);
+
 struct regex *regex_incref(struct regex *regex);
 struct regex *regex_decref(struct regex *regex);
 unsigned regex_size(struct regex *regex);
@@ -31,6 +39,7 @@ struct regex *regex_negeps(void);
 struct regex *regex_ignorecase(struct regex *regex, bool dual);
 struct regex *regex_reverse(struct regex *regex);
 struct regex *regex_differentiate(struct regex *regex, uint8_t chr);
+void regex_memo_stats(size_t *hits, size_t *misses);
 
 struct dstate *dstate_alloc(struct regex *regex);
 void dfa_free(struct dstate *dfa);
@@ -40,14 +49,104 @@ struct dstate *dfa_deserialize(uint8_t *image, size_t *size);
 
 void dfa_mark(struct dstate *dfa);
 void dfa_minimize(struct dstate *dfa);
+void dfa_minimize_parallel(struct dstate *dfa, int threads);
 bool dfa_equivalent(struct dstate *dfa1, struct dstate *dfa2);
 
+// contiguous transition table built from a complete DFA, for matching. state
+// identifiers are premultiplied row offsets into `table`, whose entries are
+// `width` bytes wide. states are ordered so that terminating states and
+// accepting states are contiguous, making both properties range checks, and
+// so that terminating and accelerated states come first: matchers only need
+// to compare against `stop` to know when to leave their fast loop. after the
+// transitions come `stop / stride` records of exit characters, one per state
+// below `stop`, each a count followed by up to three characters; see
+// `dfa_accelerate`. DFAs of at most 16 states built where `pshufb` is
+// available then get a shuffle table: one 16-byte row per input character,
+// mapping the plain row index of each state to that of its successor. last,
+// aligned to two bytes, comes the optional stride-2 table, which maps a state
+// and two input characters to the state two steps later. its `size * stride *
+// stride` entries are row offsets premultiplied by `stride * stride`, so a
+// lookup is one addition per character. a `struct dtable` is also its own
+// image: it is a single fixed-layout block of `dtable_get_size` bytes that can
+// be written out as-is then `mmap`ed and matched in place after `dtable_load`.
+// images use native byte order
+#define DTABLE_MAGIC 0x3464746cu // "ltd4" on little-endian machines
+#define DTABLE_PAIRS_MAX (1 << 16) // so that entries fit `uint16_t`
+struct dtable {
+  uint32_t magic;
+  uint32_t width; // 1, 2 or 4
+  uint32_t stride, size; // number of columns and of states
+  uint32_t initial, stop, term_lo, term_hi, accept_lo, accept_hi;
+  uint32_t pairs; // entries in the stride-2 table, or 0 if there is none
+  uint32_t shuffles; // rows in the shuffle table, 256 or 0 if none
+  uint8_t map[256]; // input character to column, like `struct dclasses`
+  uint8_t table[]; // `size * stride` entries, suitably aligned for `width`
+};
+inline uint32_t dtable_step(struct dtable *dtable, uint32_t id, uint8_t chr) {
+  id += dtable->map[chr];
+  return dtable->width == 1   ? ((uint8_t *)dtable->table)[id]
+         : dtable->width == 2 ? ((uint16_t *)dtable->table)[id]
+                              : ((uint32_t *)dtable->table)[id];
+}
+inline bool dtable_terminating(struct dtable *dtable, uint32_t id) {
+  return id - dtable->term_lo < dtable->term_hi - dtable->term_lo;
+}
+inline bool dtable_accepting(struct dtable *dtable, uint32_t id) {
+  return id - dtable->accept_lo < dtable->accept_hi - dtable->accept_lo;
+}
+struct dtable *dtable_alloc(struct dstate *dfa);
+void dtable_free(struct dtable *dtable);
+size_t dtable_get_size(struct dtable *dtable);
+struct dtable *dtable_load(uint8_t *image, size_t size, char **error);
+uint8_t *dtable_run(struct dtable *dtable, uint32_t *id, uint8_t *begin,
+                   uint8_t *end, int eol);
+uint32_t dtable_run_parallel(struct dtable *dtable, uint32_t id, uint8_t *begin,
+                             uint8_t *end, int threads);
+
 struct regex *ltre_parse(char **pattern, char **error);
 struct regex *ltre_fixed_string(char *string);
 char *ltre_stringify(struct regex *regex);
+uint8_t *ltre_required(struct regex *regex, size_t *len);
+uint8_t *ltre_search(uint8_t *begin, uint8_t *end, uint8_t *literal,
+                     size_t len);
+// packed search for any of a set of literals that every match contains one of;
+// see `prefilter_alloc`
+struct prefilter;
+struct prefilter *prefilter_alloc(struct regex *regex);
+void prefilter_free(struct prefilter *filter);
+uint8_t *prefilter_find(struct prefilter *filter, uint8_t *begin,
+                        uint8_t *end);
 
 bool ltre_matches_lazy(struct dstate **dfap, uint8_t *input);
+// budgeted cache of lazily constructed DFA states; see `ltre_matches_cached`
+struct dcache {
+  struct dstate *dfa; // partial DFA, as for `ltre_matches_lazy`
+  size_t budget;      // in bytes
+  size_t flushes;     // number of times the cache was flushed so far
+};
+bool ltre_matches_cached(struct dcache *cache, uint8_t *input);
+struct cnfa *cnfa_alloc(struct regex *regex, char **error);
+void cnfa_free(struct cnfa *cnfa);
+bool ltre_matches_counting(struct cnfa *cnfa, uint8_t *input);
+struct gnfa *gnfa_alloc(struct regex *regex, char **error);
+void gnfa_free(struct gnfa *gnfa);
+bool ltre_matches_glushkov(struct gnfa *gnfa, uint8_t *input);
 struct dstate *ltre_compile(struct regex *regex);
+// limits for `ltre_compile_budget`, which also reports statistics through it.
+// zero means no limit. bytes cover the states of the DFA under construction,
+// along with the regexes, derivative classes and tables that the current
+// context grows by meanwhile. the parallel compilation paths are unbudgeted
+struct dbudget {
+  size_t max_states, max_bytes;
+  size_t timeout_ms; // wall-clock time, from the call on
+  size_t states, bytes;
+};
+struct dstate *ltre_compile_budget(struct regex *regex, struct dbudget *budget,
+                                   char **error);
 struct dstate *ltre_determinize(struct regex *regex);
+struct dstate *ltre_determinize_parallel(struct regex *regex, int threads);
+struct dstate *ltre_compile_parallel(struct regex *regex, int threads);
+struct dstate *ltre_compile_strings(char *strings[], size_t len);
 bool ltre_matches(struct dstate *dfa, uint8_t *input);
+bool ltre_matches_table(struct dtable *dtable, uint8_t *input);
 struct regex *ltre_decompile(struct dstate *dfa);
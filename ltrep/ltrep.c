@@ -10,12 +10,6 @@
 #include <unistd.h>
 #endif
 
-// steal implementation details. this probably has undefined behavior
-struct dstate {
-  struct dstate *transitions[256];
-  bool accepting, terminating;
-};
-
 char *opts = "v   pxo oxp isS Ssi FE  Hh  nN  kK  "
              "b   Tt  clL lcL Lcl 0   zZ1 1Zz q   ";
 struct args {
@@ -147,6 +141,13 @@ struct args parse_args(char **argv) {
   return args;
 }
 
+struct dtable *compile(struct regex *regex) {
+  // we only ever need the compact matcher, so free the DFA right away
+  struct dstate *dfa = ltre_compile(regex);
+  struct dtable *dtable = dtable_alloc(dfa);
+  return dfa_free(dfa), dtable;
+}
+
 int main(int argc, char **argv) {
   struct args args = parse_args(argv);
 
@@ -190,14 +191,14 @@ int main(int argc, char **argv) {
   // but that means performing one forward scan within which we perform several
   // backward scans, and that's not as nice to the prefetcher
 
-  struct dstate *rev_dfa = NULL, *fwd_dfa = NULL;
+  struct dtable *rev_dfa = NULL, *fwd_dfa = NULL;
 
   if (args.opts.ignore || args.opts.smart && all_lower)
     regex = regex_ignorecase(regex, false);
   if (args.opts.onlymch && !args.opts.invert && !args.opts.quiet &&
       !args.opts.list && !args.opts.nlist) {
-    fwd_dfa = ltre_compile(regex_incref(regex));
-    rev_dfa = ltre_compile(regex_reverse(
+    fwd_dfa = compile(regex_incref(regex));
+    rev_dfa = compile(regex_reverse(
         regex_concat(REGEXES(regex_incref(regex), regex_univ()))));
   }
   if (args.opts.partial || args.opts.onlymch)
@@ -205,7 +206,11 @@ int main(int argc, char **argv) {
   if (args.opts.invert)
     regex = regex_compl(regex);
 
-  struct dstate *dfa = ltre_compile(regex);
+  // every match contains one of the literals of `filter`, so lines without
+  // any can be skipped over with a fast search. it is `NULL` for '-v', among
+  // others
+  struct prefilter *filter = prefilter_alloc(regex);
+  struct dtable *dfa = compile(regex);
 
   // be extremely careful with -o: in general, the space and time complexity
   // becomes quadratic in the input length. to preserve linear-time, linear-
@@ -241,20 +246,20 @@ int main(int argc, char **argv) {
   do { /* args.opts, file, lineno, lineoff, &count, line, len, fwd&rev_dfa */  \
     if (fwd_dfa && rev_dfa) {                                                  \
       uint8_t *begin = line + len; /* rightmost to leftmost */                 \
-      for (struct dstate *dstate = rev_dfa;;                                   \
-           dstate = dstate->transitions[*--begin]) {                           \
-        if (dstate->accepting) {                                               \
+      for (uint32_t id = rev_dfa->initial;;                                    \
+           id = dtable_step(rev_dfa, id, *--begin)) {                          \
+        if (dtable_accepting(rev_dfa, id)) {                                   \
           uint8_t *end = begin; /* shortest to longest */                      \
-          for (struct dstate *dstate = fwd_dfa;;                               \
-               dstate = dstate->transitions[*end++]) {                         \
-            if (dstate->accepting)                                             \
+          for (uint32_t id = fwd_dfa->initial;;                                \
+               id = dtable_step(fwd_dfa, id, *end++)) {                        \
+            if (dtable_accepting(fwd_dfa, id))                                 \
               OUTPUT_MATCH;                                                    \
-            else if (dstate->terminating)                                      \
+            else if (dtable_terminating(fwd_dfa, id))                          \
               break;                                                           \
             if (end == line + len)                                             \
               break;                                                           \
           }                                                                    \
-        } else if (dstate->terminating)                                        \
+        } else if (dtable_terminating(rev_dfa, id))                            \
           break;                                                               \
         if (begin == line)                                                     \
           break;                                                               \
@@ -316,9 +321,31 @@ int main(int argc, char **argv) {
       uint8_t *line = data, *p = data;
 
       for (; p < data + size; line = ++p) {
-        struct dstate *dstate = dfa;
-        while (!dstate->terminating && p < data + size && *p != ieol)
-          dstate = dstate->transitions[*p++];
+        if (filter && ieol == EOF && !prefilter_find(filter, p, data + size)) {
+          lineno++, lineoff += size + 1;
+          break; // the one line can't match, no need to run the DFA
+        }
+        if (filter && ieol != EOF) {
+          // skip to the line holding the next candidate, or to the last line.
+          // whole lines only, so that `lineno` stays exact
+          uint8_t *hit = prefilter_find(filter, p, data + size);
+          uint8_t *next = hit ? hit : data + size;
+          while (next > p && next[-1] != ieol)
+            next--;
+          for (; (p = memchr(p, ieol, next - p)); line = ++p)
+            lineno++, lineoff += p - line + 1;
+          line = p = next;
+        }
+
+        // the one line can be huge, so spread it across all cores. the state
+        // reached is all we need to know about it
+        uint32_t id = dfa->initial;
+        if (ieol == EOF)
+          id = dtable_run_parallel(dfa, id, p, data + size,
+                                   sysconf(_SC_NPROCESSORS_ONLN)),
+          p = data + size;
+        else
+          p = dtable_run(dfa, &id, p, data + size, ieol);
         if (p < data + size && *p != ieol)
           ieol != EOF && (p = memchr(p, ieol, data + size - p)) ||
               (p = data + size);
@@ -326,7 +353,7 @@ int main(int argc, char **argv) {
 
         if (!args.opts.oneline && p == data + size && len == 0)
           break; // ignore partial line if it's empty
-        if (dstate->accepting) {
+        if (dtable_accepting(dfa, id)) {
           OUTPUT_LINE;
           if (args.opts.quiet || exit_status != EXIT_ERROR)
             exit_status = EXIT_MATCH; // without '-q', EXIT_ERROR takes priority
@@ -355,17 +382,17 @@ int main(int argc, char **argv) {
     uint8_t *line = malloc(cap);
 
     for (; !feof(fp); len = 0) {
-      struct dstate *dstate = dfa;
+      uint32_t id = dfa->initial;
       for (int c; c = fgetc(fp), c != EOF && c != ieol; line[len++] = c) {
         len == cap ? line = realloc(line, cap *= 2) : 0;
-        dstate = dstate->transitions[c];
+        id = dtable_step(dfa, id, c);
       }
       if (ferror(fp) ? free(line), fclose(fp), 1 : 0)
         goto perror_continue;
 
       if (!args.opts.oneline && feof(fp) && len == 0)
         break; // ignore partial line if it's empty
-      if (dstate->accepting) {
+      if (dtable_accepting(dfa, id)) {
         OUTPUT_LINE;
         if (args.opts.quiet || exit_status != EXIT_ERROR)
           exit_status = EXIT_MATCH; // without '-q', EXIT_ERROR takes priority
@@ -392,8 +419,8 @@ int main(int argc, char **argv) {
       exit_status = EXIT_ERROR; // with '-q', EXIT_MATCH takes priority
   }
 
-  dfa_free(dfa);
-  dfa_free(rev_dfa), dfa_free(fwd_dfa);
+  dtable_free(dfa), prefilter_free(filter);
+  dtable_free(rev_dfa), dtable_free(fwd_dfa);
 
   return exit_status;
 }
@@ -179,6 +179,14 @@ echo $? 172 >> test.act; echo -e 'a'  | $@ -Lc 'a' >> test.act
 echo $? 173 >> test.act; echo -e 'a'  | $@ -cL 'a' >> test.act
 echo $? 174 >> test.act; echo -e 'a'  | $@ -Ll 'a' >> test.act
 echo $? 175 >> test.act; echo -e 'a'  | $@ -lL 'a' >> test.act
+#else   176 partial matches in mapped files
+echo $? 177 >> test.act; $@ -pn 'YARA' yara.ltre >> test.act
+echo $? 178 >> test.act; $@ -pc 'rule' yara.ltre >> test.act
+echo $? 179 >> test.act; $@ -pnk 'ltrep' yara.ltre >> test.act
+echo $? 180 >> test.act; $@ -pvc 'e' yara.ltre >> test.act
+echo $? 181 >> test.act; $@ -pn '(ELF|YARA|rule)' yara.ltre >> test.act
+echo $? 182 >> test.act; $@ -1pc '(xyzzy|plugh)' yara.ltre >> test.act
+echo $? 183 >> test.act; $@ -1pc '(xyzzy|rule)' yara.ltre >> test.act
 
 diff --text test.exp test.act
 # cp test.act test.exp # for updating the test suite
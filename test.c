@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __unix__
+#include <pthread.h>
+#endif
 
 struct test {
   char *pattern;
@@ -18,7 +21,14 @@ struct test {
 void test(struct test args) {
 #define test(...) test((struct test){__VA_ARGS__})
   static struct test memo = {0};
-  static struct dstate *dfa = NULL, *ldfa = NULL;
+  static struct dstate *dfa = NULL, *ldfa = NULL, *mdfa = NULL;
+  static struct dtable *dtable = NULL;
+  static struct dcache cache = {0};
+  static struct cnfa *cnfa = NULL;
+  static struct gnfa *gnfa = NULL;
+  static uint8_t *literal = NULL;
+  static size_t literal_len = 0;
+  static struct prefilter *filter = NULL;
 
   if (memo.pattern && strcmp(memo.pattern, args.pattern) == 0 &&
       memcmp(&memo.errors, &args.errors, sizeof(bool[6])) == 0)
@@ -60,6 +70,25 @@ void test(struct test args) {
   struct dstate *clone;
   dfa_free(dfa), dfa = ltre_compile(regex_incref(regex));
 
+  // regex -> dfa, within budget
+  struct dbudget budget = {0};
+  clone = ltre_compile_budget(regex_incref(regex), &budget, &error);
+  if (!dfa_equivalent(dfa, clone))
+    abort(); // invariant broken
+  dfa_free(clone);
+
+  // regex -> dfa, in parallel. as many states as the serial determinization
+  clone = ltre_determinize_parallel(regex_incref(regex), 3);
+  if (dfa_get_size(clone) != (int)budget.states)
+    abort(); // invariant broken
+  if (dfa_minimize_parallel(clone, 3), !dfa_equivalent(dfa, clone))
+    abort(); // invariant broken
+  dfa_free(clone);
+  budget = (struct dbudget){.max_states = budget.states - 1};
+  if (budget.max_states &&
+      ltre_compile_budget(regex_incref(regex), &budget, &error))
+    abort(); // invariant broken
+
   // dfa -> image -> dfa
   size_t write_size, read_size;
   uint8_t *image = dfa_serialize(dfa, &write_size);
@@ -83,15 +112,359 @@ void test(struct test args) {
     dfa_free(clone);
   }
 
-  dfa_free(ldfa), ldfa = dstate_alloc(regex);
+  // dfa -> table -> image -> table
+  dtable_free(dtable), dtable = dtable_alloc(dfa);
+  size_t table_size = dtable_get_size(dtable);
+  uint8_t *table_image = malloc(table_size);
+  memcpy(table_image, dtable, table_size), dtable_free(dtable);
+  dtable = (struct dtable *)table_image, dtable->initial += table_size;
+  if (dtable_load(table_image, table_size, &error))
+    abort(); // invariant broken
+  dtable->initial -= table_size;
+  if (dtable_load(table_image, table_size - 1, &error))
+    abort(); // invariant broken
+  if (dtable->shuffles) {
+    // right past the records
+    uint8_t *shuffle = dtable->table +
+                       dtable->size * dtable->stride * dtable->width +
+                       dtable->stop / dtable->stride * 4,
+            saved = *shuffle;
+    *shuffle = 16; // out of range
+    if (dtable_load(table_image, table_size, &error))
+      abort(); // invariant broken
+    *shuffle = saved;
+  }
+  if (dtable->pairs) {
+    uint16_t *pair = (uint16_t *)(table_image + table_size) - 1, saved = *pair;
+    *pair = UINT16_MAX; // out of range for all but the largest tables
+    if (dtable_load(table_image, table_size, &error))
+      abort(); // invariant broken
+    *pair = saved;
+  }
+  if ((dtable = dtable_load(table_image, table_size, &error)) == NULL)
+    abort(); // invariant broken
+
+  // regex -> dfa, marked but not minimized
+  dfa_free(mdfa), mdfa = ltre_determinize(regex_incref(regex)), dfa_mark(mdfa);
+
+  // regex -> counting automaton, unless it has complements
+  if (cnfa)
+    cnfa_free(cnfa);
+  cnfa = cnfa_alloc(regex_incref(regex), &error);
+
+  // regex -> Glushkov automaton, unless it has complements or is too large
+  if (gnfa)
+    gnfa_free(gnfa);
+  gnfa = gnfa_alloc(regex_incref(regex), &error);
+
+  // regex -> required literal, which every match must contain
+  free(literal), literal = ltre_required(regex, &literal_len);
+  prefilter_free(filter), filter = prefilter_alloc(regex);
+
+  dfa_free(ldfa), ldfa = dstate_alloc(regex_incref(regex));
+  // zero budget, so the cache gets flushed upon every new state
+  dfa_free(cache.dfa), cache = (struct dcache){.dfa = dstate_alloc(regex)};
 
   memo = args;
 check_matches:
   if (ltre_matches(dfa, (uint8_t *)args.input) != args.matches ||
-      ltre_matches_lazy(&ldfa, (uint8_t *)args.input) != args.matches)
+      ltre_matches(mdfa, (uint8_t *)args.input) != args.matches ||
+      ltre_matches_table(dtable, (uint8_t *)args.input) != args.matches ||
+      ltre_matches_lazy(&ldfa, (uint8_t *)args.input) != args.matches ||
+      ltre_matches_cached(&cache, (uint8_t *)args.input) != args.matches ||
+      (cnfa &&
+       ltre_matches_counting(cnfa, (uint8_t *)args.input) != args.matches) ||
+      (gnfa &&
+       ltre_matches_glushkov(gnfa, (uint8_t *)args.input) != args.matches) ||
+      args.matches && !ltre_search((uint8_t *)args.input,
+                                   (uint8_t *)args.input + strlen(args.input),
+                                   literal, literal_len) ||
+      args.matches && filter &&
+          !prefilter_find(filter, (uint8_t *)args.input,
+                          (uint8_t *)args.input + strlen(args.input)))
     printf("test failed: /%s/ against '%s'\n", args.pattern, args.input);
 }
 
+// dictionaries compiled directly, checked against the alternation of their
+// strings compiled the usual way. entries are terminated by `NULL`
+static char *strings_cases[][8] = {
+    {NULL},
+    {"", NULL},
+    {"abc", NULL},
+    {"tap", "taps", "top", "tops", "", NULL},
+    {"stop", "stops", "top", "tops", "stop", "top", NULL},
+    {"\x01\xff", "\xff", "\x80\x80\x80", "~", NULL},
+};
+
+static void strings_check(char *strings[], size_t len) {
+  struct regex *children[len + 1];
+  for (size_t i = 0; i < len; i++)
+    children[i] = ltre_fixed_string(strings[i]);
+  children[len] = NULL;
+  struct dstate *dfa = ltre_compile(regex_alt(children));
+  struct dstate *sdfa = ltre_compile_strings(strings, len);
+  if (!dfa_equivalent(dfa, sdfa))
+    printf("test failed: dictionary of %zu strings\n", len);
+  for (size_t i = 0; i < len; i++)
+    if (!ltre_matches(sdfa, (uint8_t *)strings[i]))
+      printf("test failed: dictionary against '%s'\n", strings[i]);
+  dfa_free(dfa), dfa_free(sdfa);
+}
+
+static void strings(void) {
+  for (size_t i = 0; i < sizeof strings_cases / sizeof *strings_cases; i++) {
+    size_t len = 0;
+    while (strings_cases[i][len])
+      len++;
+    strings_check(strings_cases[i], len);
+  }
+
+  // shared prefixes and suffixes, out of order
+  static char words[2000][8], *ptrs[2000];
+  for (int i = 0; i < 2000; i++)
+    sprintf(words[i], "%d", i * 7919 % 2000 * 3), ptrs[i] = words[i];
+  strings_check(ptrs, 2000);
+}
+
+// literals that `ltre_required` should find. soundness is checked by `test`
+static char *required_cases[][2] = {
+    {"abc", "abc"},
+    {"(ab){3}", "ababab"},
+    {"(abc)+", "abc"},
+    {"(foo)?bar", "bar"},
+    {"a\\d+bcd", "bcd"},
+    {"abc|abd", "ab"},
+    {"xabc|yabc", "abc"},
+    {"%foo(bar|baz)%", "fooba"},
+    {"%ERROR\\ code\\ \\d+%", "ERROR code "},
+    {"!abc", ""},
+    {"%abc%&%defg%", "defg"},
+    {"%abc%&!%def%", "abc"},
+    {"!(%abc%&%def%)", ""},
+};
+
+static void required(void) {
+  for (size_t i = 0; i < sizeof required_cases / sizeof *required_cases; i++) {
+    char *loc = required_cases[i][0];
+    struct regex *regex = ltre_parse(&loc, NULL);
+    size_t len;
+    uint8_t *literal = ltre_required(regex, &len);
+    if (len != strlen(required_cases[i][1]) ||
+        memcmp(literal, required_cases[i][1], len) != 0)
+      printf("test failed: /%s/ required literal\n", required_cases[i][0]);
+    free(literal), regex_decref(regex);
+  }
+}
+
+// literal sets that `prefilter_alloc` should find, checked by searching a
+// generated haystack for them. entries are terminated by `NULL`
+static char *prefilter_cases[][12] = {
+    {"%(foo|bar|baz)%", "bar", "baz", "foo", NULL},
+    {"%(alpha|beta|gamma|delta|epsilon|zeta|eta|theta|iota)%", "alpha", "beta",
+     "delta", "epsilon", "eta", "gamma", "iota", "theta", "zeta", NULL},
+    {"(cat|dog)s?\\ (bite|bark)%", "bark", "bite", NULL},
+    {"%(a|b)c%", "c", NULL},
+    {"%ab%&%(xy|zy)%", "ab", NULL},
+    {"%", NULL},
+    {"!%foo%", NULL},
+};
+
+static void prefilters(void) {
+  // letters of the literals, so that candidates come often, and planted
+  // literals, so that they are found at all alignments
+  static uint8_t haystack[4096];
+  static char *words[] = {"foo", "baz", "alpha", "theta", "iota", "bark",
+                          "bite", "c", "ab", "xy"};
+  unsigned seed = 1;
+  for (size_t i = 0; i < sizeof(haystack); i++)
+    seed = seed * 1103515245 + 12345,
+    haystack[i] = "abdefghilmnopstz"[seed >> 16 & 15];
+  for (size_t i = 0; i + 8 < sizeof(haystack); i += seed >> 16 & 63) {
+    seed = seed * 1103515245 + 12345;
+    char *word = words[(seed >> 16) % (sizeof(words) / sizeof(*words))];
+    memcpy(haystack + i, word, strlen(word));
+  }
+
+  for (size_t i = 0; i < sizeof prefilter_cases / sizeof *prefilter_cases; i++) {
+    char *loc = prefilter_cases[i][0], **lits = prefilter_cases[i] + 1;
+    struct regex *regex = ltre_parse(&loc, NULL);
+    struct prefilter *filter = prefilter_alloc(regex);
+    if (!filter != !*lits)
+      printf("test failed: /%s/ prefilter\n", prefilter_cases[i][0]);
+    for (int e = 0; filter && e < 40; e++) {
+      uint8_t *end = haystack + sizeof(haystack) - e;
+      for (uint8_t *p = haystack, *hit;; p = hit + 1) {
+        uint8_t *expected = NULL;
+        for (uint8_t *q = p; q < end && !expected; q++)
+          for (char **lit = lits; *lit && !expected; lit++)
+            if (strlen(*lit) <= (size_t)(end - q) &&
+                memcmp(q, *lit, strlen(*lit)) == 0)
+              expected = q;
+        if ((hit = prefilter_find(filter, p, end)) != expected) {
+          printf("test failed: /%s/ prefilter at %td\n", prefilter_cases[i][0],
+                 p - haystack);
+          break;
+        }
+        if (!hit)
+          break;
+      }
+    }
+    prefilter_free(filter), regex_decref(regex);
+  }
+}
+
+// DFAs for these patterns have exponentially many states, so compilation gives
+// up within budget and the Glushkov automaton takes over. inputs are the mark
+// after some filler, followed by `len` more characters of filler
+static struct {
+  char *pattern, mark, filler;
+  int len;
+} glushkov_cases[] = {
+    {"%a.{30}", 'a', 'b', 30},
+    {"%a.{100}", 'a', 'b', 100},
+    {"%1[01]{200}", '1', '0', 200},
+};
+
+static void glushkov(void) {
+  for (size_t i = 0; i < sizeof glushkov_cases / sizeof *glushkov_cases; i++) {
+    char *loc = glushkov_cases[i].pattern, *error = NULL, input[256];
+    struct regex *regex = ltre_parse(&loc, NULL);
+    struct dbudget budget = {.max_states = 10000};
+    if (ltre_compile_budget(regex_incref(regex), &budget, &error))
+      printf("test failed: /%s/ within budget\n", glushkov_cases[i].pattern);
+    budget = (struct dbudget){.timeout_ms = 1}, error = NULL;
+    if (ltre_compile_budget(regex_incref(regex), &budget, &error) ||
+        strcmp(error, "deadline exceeded") != 0)
+      printf("test failed: /%s/ within deadline\n", glushkov_cases[i].pattern);
+    budget = (struct dbudget){.max_bytes = 1 << 20}, error = NULL;
+    if (ltre_compile_budget(regex_incref(regex), &budget, &error) ||
+        strcmp(error, "memory limit exceeded") != 0)
+      printf("test failed: /%s/ within memory\n", glushkov_cases[i].pattern);
+    struct gnfa *gnfa = gnfa_alloc(regex, &error);
+
+    int len = glushkov_cases[i].len;
+    for (int extra = -1; extra <= 1; extra++) {
+      memset(input, glushkov_cases[i].filler, 5 + 1 + len + extra);
+      input[5] = glushkov_cases[i].mark, input[5 + 1 + len + extra] = '\0';
+      if (ltre_matches_glushkov(gnfa, (uint8_t *)input) != (extra == 0))
+        printf("test failed: /%s/ against %d characters\n",
+               glushkov_cases[i].pattern, len + extra);
+    }
+    memset(input, glushkov_cases[i].mark, 1 + len), input[1 + len] = '\0';
+    if (!ltre_matches_glushkov(gnfa, (uint8_t *)input))
+      printf("test failed: /%s/ against marks\n", glushkov_cases[i].pattern);
+    gnfa_free(gnfa);
+  }
+}
+
+// inputs long enough for `dtable_run_parallel` to split, with a mark at the
+// start, in the middle, at the end or nowhere. some runs never converge
+static char *speculate_cases[] = {
+    "%abc%", "!%abc%", "(..)*", "(.{32})*", "%a.{3}", "%abc(..)*",
+};
+
+static void speculate(void) {
+  size_t len = 3 << 20 | 1;
+  uint8_t *input = malloc(len);
+  size_t marks[] = {0, len / 2, len - 3, len};
+  for (size_t i = 0; i < sizeof speculate_cases / sizeof *speculate_cases;
+       i++) {
+    char *loc = speculate_cases[i];
+    struct dstate *dfa = ltre_compile(ltre_parse(&loc, NULL));
+    struct dtable *dtable = dtable_alloc(dfa);
+    for (size_t j = 0; j < sizeof marks / sizeof *marks; j++) {
+      for (size_t k = 0, seed = 1; k < len; k++)
+        seed = seed * 1103515245 + 12345, input[k] = "abd"[(seed >> 16) % 3];
+      if (marks[j] < len)
+        memcpy(input + marks[j], "abc", 3);
+      uint32_t id = dtable->initial;
+      dtable_run(dtable, &id, input, input + len, EOF);
+      for (int threads = 2; threads <= 8; threads *= 2)
+        if (dtable_run_parallel(dtable, dtable->initial, input, input + len,
+                                threads) != id)
+          printf("test failed: /%s/ with mark %zu across %d threads\n",
+                 speculate_cases[i], j, threads);
+    }
+    dtable_free(dtable), dfa_free(dfa);
+  }
+  free(input);
+}
+
+#ifdef __unix__
+// compiled over and over by concurrent threads, each in its own context, with
+// the results checked against those of a sequential run
+#define STRESS_THREADS 4
+#define STRESS_ROUNDS 8
+static char *stress_cases[][2] = {
+    {"(x+x+)+y", "xxxxxxxxxxxxxxxxxxxxy"},
+    {"[01]*1[01]{8}", "11011100011100"},
+    {"%0%|%1%|%2%|%3%|%4%|%5%", "123"},
+    {"(0|1-90-9*){3}!\\.", "1.20.300"},
+    {"%(a|b)(a|b){5}&!%aba%", "bbbbbbabbab"},
+    {"[a-z]+(\\.[a-z]+)*<.\\->[a-z]+\\.(com|org)", "first.last.mail.org"},
+};
+#define STRESS_CASES (sizeof stress_cases / sizeof *stress_cases)
+
+struct stress {
+  char *pattern; // stringified
+  uint8_t *image;
+  size_t size;
+  bool matches;
+};
+
+static void stress_run(struct stress *results) {
+  for (size_t i = 0; i < STRESS_CASES; i++) {
+    char *loc = stress_cases[i][0];
+    struct regex *regex = ltre_parse(&loc, NULL);
+    results[i].pattern = ltre_stringify(regex_incref(regex));
+    struct dstate *ldfa = dstate_alloc(regex_incref(regex));
+    results[i].matches =
+        ltre_matches_lazy(&ldfa, (uint8_t *)stress_cases[i][1]);
+    dfa_free(ldfa);
+    struct dstate *dfa = ltre_compile(regex);
+    results[i].image = dfa_serialize(dfa, &results[i].size), dfa_free(dfa);
+  }
+}
+
+static void stress_free(struct stress *results) {
+  for (size_t i = 0; i < STRESS_CASES; i++)
+    free(results[i].pattern), free(results[i].image);
+}
+
+static void *stress_thread(void *expected) {
+  struct ltre_ctx *ctx = ltre_ctx_alloc();
+  ltre_ctx_use(ctx);
+  for (int round = 0; round < STRESS_ROUNDS; round++) {
+    struct stress results[STRESS_CASES], *ex = expected;
+    stress_run(results);
+    for (size_t i = 0; i < STRESS_CASES; i++)
+      if (strcmp(results[i].pattern, ex[i].pattern) != 0 ||
+          results[i].size != ex[i].size ||
+          memcmp(results[i].image, ex[i].image, ex[i].size) != 0 ||
+          results[i].matches != ex[i].matches)
+        printf("test failed: /%s/ concurrently\n", stress_cases[i][0]);
+    stress_free(results);
+  }
+  ltre_ctx_use(NULL), ltre_ctx_free(ctx);
+  return NULL;
+}
+
+static void stress(void) {
+  struct stress expected[STRESS_CASES];
+  struct ltre_ctx *ctx = ltre_ctx_use(ltre_ctx_alloc());
+  stress_run(expected);
+  ltre_ctx_free(ltre_ctx_use(ctx));
+
+  pthread_t threads[STRESS_THREADS];
+  for (int i = 0; i < STRESS_THREADS; i++)
+    if (pthread_create(&threads[i], NULL, stress_thread, expected) != 0)
+      abort();
+  for (int i = 0; i < STRESS_THREADS; i++)
+    pthread_join(threads[i], NULL);
+  stress_free(expected);
+}
+#endif
+
 int main(void) {
   // catastrophic backtracking
   test("a**c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false);
@@ -105,6 +478,33 @@ int main(void) {
   test("[01]*1[01]{8}", "11011100011100", true, .quick = true);
   test("[01]*1[01]{8}", "01010010010010", false, .quick = true);
 
+  // large bounded repetitions; see `ltre_matches_counting`
+  test("0-9{1,500}", "0123456789", true, .quick = true);
+  test("0-9{1,500}", "01234x6789", false, .quick = true);
+  test("(~\\n){200}\\n", "\\n", false, .quick = true);
+  test("(a{2,3}b{20,})+", "aaabbbbbbbbbbbbbbbbbbbbaab", false, .quick = true);
+  // bound too large for a counting set, but the DFA is tiny
+  test("a{1,4000000000}%", "aaab", true, .quick = true);
+  test("a{1,4000000000}%", "baaa", false, .quick = true);
+
+  // chain of states that takes many rounds of parallel minimization
+  test("a{80}",
+       "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+       "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+       true);
+  test("a{80}",
+       "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+       "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+       false);
+
+  // generated alternation, too long to parse by recursion or to sort pairwise
+  char alts[10000 * 8], *alt = alts;
+  for (int i = 0; i < 10000; i++)
+    alt += sprintf(alt, "%sw%d", i ? "|" : "", i);
+  test(alts, "w1234", true, .quick = true);
+  test(alts, "w12345", false, .quick = true);
+  test(alts, "w0|w1", false, .quick = true);
+
   // potential edge cases
   test("abba", "abba", true);
   test("ab|abba", "abba", true);
@@ -994,4 +1394,36 @@ int main(void) {
        "99999999999999999999999.999999999999999999.99999999999999999"
        "----RC-SNAPSHOT.12.09.1--------------------------------..12",
        false);
+
+  // tiny DFAs over inputs longer than a few groups of 8 characters
+  test("\\d{1,3}(\\.\\d{1,3}){3}", "192.168.100.200", true);
+  test("\\d{1,3}(\\.\\d{1,3}){3}", "192.168.100.2000", false);
+  test("\\d{1,3}(\\.\\d{1,3}){3}", "192.168.100.20a", false);
+  test("%[A-Z]{3}\\d%", "the quick brown fox jumps over the lazy ABC dog",
+       false);
+  test("%[A-Z]{3}\\d%", "the quick brown fox jumps over the lazy ABC1 dog",
+       true);
+  test("%[A-Z]{3}\\d%", "the quick brown fox jumps over the lazy dog ABC1",
+       true);
+  test("[ab]*a[ab][ab]", "abababababababbbbbbaaaaaabababbbbbbabb", true);
+  test("[ab]*a[ab][ab]", "abababababababbbbbbaaaaaabababbbbbbbab", false);
+  test("[ab]*a[ab][ab]", "abababababababbbbbbaaaaaabababbbbbbcabb", false);
+
+  // dictionaries
+  strings();
+
+  // exponential DFAs
+  glushkov();
+
+  // speculative parallel matching
+  speculate();
+
+  // required literals
+  required();
+  prefilters();
+
+#ifdef __unix__
+  // concurrent compiles in independent contexts
+  stress();
+#endif
 }